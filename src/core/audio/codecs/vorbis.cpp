@@ -1,6 +1,8 @@
 #include "config.hpp"
 #include "vorbis.hpp"
+#include "kernels.hpp"
 
+#include <algorithm>
 #include <stdexcept>
 #include <map>
 #include <string>
@@ -41,6 +43,8 @@ namespace ORCore {
         }
 
         m_info = ov_info(&m_vorbisFile,-1);
+        m_decodeBuffer.resize(decodeBufferFrames * getChannelCount());
+        m_channelOffsets.resize(getChannelCount());
 
         if (ov_pcm_seek(&m_vorbisFile, 0) != 0) {  // This is because some files do not seek to 0 automatically
             throw std::runtime_error(_("Error seeking file to position 0."));
@@ -58,29 +62,49 @@ namespace ORCore {
         return m_position;
     }
 
+    long VorbisInput::getFrameCount() {
+        long frameCount = ov_pcm_total(&m_vorbisFile, -1);
+        if (frameCount < 0)
+            throw std::runtime_error(errorCodeMap[frameCount]);
+        return frameCount;
+    }
+
     int VorbisInput::process(int frameCount) {
+        int channelCount = getChannelCount();
+        frameCount = std::min(frameCount, getFramesInBuffer() + getFramesFree());
+
         float **p_decodedFrames; // This will point on the decoded frames
-        while (m_framesInBuffer < frameCount) {
+        while (getFramesInBuffer() < frameCount) {
+            int framesWanted = std::min(frameCount - getFramesInBuffer(), decodeBufferFrames);
             int framesDecoded = ov_read_float(&m_vorbisFile, &p_decodedFrames,
-                frameCount - m_framesInBuffer, &currentSection);
+                framesWanted, &currentSection);
 
             if (framesDecoded < 0)
                 throw std::runtime_error(errorCodeMap[framesDecoded]);
 
-
-            for (int f = 0; f < framesDecoded; ++f) {
-                for (int c = 0; c < getChannelCount(); ++c) {
-                    m_outputBuffer.push_back(p_decodedFrames[c][f]);
-                }
-                m_framesInBuffer++;
-            }
-
             // End of file, stop asking for frames but fill the buffer with zeros!
             if (framesDecoded == 0) {
                 m_eof = true;
-                m_outputBuffer.resize(frameCount*getChannelCount(), 0);
+                m_outputBuffer.fill(0.0f, (frameCount - getFramesInBuffer())*channelCount);
                 break;
             }
+
+            // Interleave straight into the output buffer. Only when the frames
+            // run past the end of its storage do the rest go through m_decodeBuffer.
+            size_t spanSamples = framesDecoded*channelCount;
+            float *span = m_outputBuffer.writeSpan(spanSamples);
+            int spanFrames = spanSamples / channelCount;
+            interleave(p_decodedFrames, span, spanFrames, channelCount);
+            m_outputBuffer.commitWrite(spanFrames*channelCount);
+
+            if (spanFrames < framesDecoded) {
+                for (int c = 0; c < channelCount; ++c) {
+                    m_channelOffsets[c] = p_decodedFrames[c] + spanFrames;
+                }
+                int restFrames = framesDecoded - spanFrames;
+                interleave(m_channelOffsets.data(), m_decodeBuffer.data(), restFrames, channelCount);
+                m_outputBuffer.write(m_decodeBuffer.data(), restFrames*channelCount);
+            }
         }
 
         // ov_time_tell gives position of the next frame. So to be more accurate
@@ -14,6 +14,9 @@
 
 namespace ORCore {
 
+    // Most frames decoded at once before they are moved to the output buffer.
+    const int decodeBufferFrames = 4096;
+
     class VorbisInput: public AudioInputStream {
     public:
 
@@ -29,6 +32,8 @@ namespace ORCore {
         virtual int getSampleRate();
         // @inherit
         virtual double getPosition();
+        // The length of the file in frames, once it is open
+        long getFrameCount();
         // @inherit
         virtual void open();
         // @inherit
@@ -46,6 +51,12 @@ namespace ORCore {
         OggVorbis_File m_vorbisFile;
         vorbis_info *m_info;
 
+        // Interleaved frames that didn't fit before the end of the output
+        // buffer's storage, and the channels of the decode offset past the
+        // frames that did. Both are sized once the file is opened.
+        AudioBuffer m_decodeBuffer;
+        std::vector<const float*> m_channelOffsets;
+
         bool m_eof = false;
         int currentSection = -1;
     };
@@ -0,0 +1,151 @@
+#include "config.hpp"
+#include "kernels.hpp"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define AUDIO_KERNELS_SSE2
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+    #define AUDIO_KERNELS_NEON
+#endif
+
+namespace ORCore {
+
+    // Where soft_clip flattens out, and the x³ divisor that puts that point at exactly 1.
+    const float softClipLimit = 1.5f;
+    const float softClipCubeScale = 1.0f / 6.75f;
+
+    static inline float soft_clip_sample(float sample) {
+        float x = std::min(std::max(sample, -softClipLimit), softClipLimit);
+        return x - x * x * x * softClipCubeScale;
+    }
+
+    void mix_samples(float *mix, const float *samples, float gain, size_t count) {
+        size_t i = 0;
+
+#if defined(AUDIO_KERNELS_SSE2)
+        const __m128 gainValue = _mm_set1_ps(gain);
+        for (; i + 4 <= count; i += 4) {
+            __m128 scaled = _mm_mul_ps(_mm_loadu_ps(samples + i), gainValue);
+            _mm_storeu_ps(mix + i, _mm_add_ps(_mm_loadu_ps(mix + i), scaled));
+        }
+#elif defined(AUDIO_KERNELS_NEON)
+        for (; i + 4 <= count; i += 4) {
+            vst1q_f32(mix + i, vmlaq_n_f32(vld1q_f32(mix + i), vld1q_f32(samples + i), gain));
+        }
+#endif
+
+        for (; i < count; ++i) {
+            mix[i] += samples[i] * gain;
+        }
+    }
+
+    void soft_clip(float *samples, size_t count) {
+        size_t i = 0;
+
+#if defined(AUDIO_KERNELS_SSE2)
+        const __m128 upper = _mm_set1_ps(softClipLimit);
+        const __m128 lower = _mm_set1_ps(-softClipLimit);
+        const __m128 cubeScale = _mm_set1_ps(softClipCubeScale);
+        for (; i + 4 <= count; i += 4) {
+            __m128 x = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(samples + i), lower), upper);
+            __m128 cube = _mm_mul_ps(_mm_mul_ps(x, x), x);
+            _mm_storeu_ps(samples + i, _mm_sub_ps(x, _mm_mul_ps(cube, cubeScale)));
+        }
+#elif defined(AUDIO_KERNELS_NEON)
+        const float32x4_t upper = vdupq_n_f32(softClipLimit);
+        const float32x4_t lower = vdupq_n_f32(-softClipLimit);
+        for (; i + 4 <= count; i += 4) {
+            float32x4_t x = vminq_f32(vmaxq_f32(vld1q_f32(samples + i), lower), upper);
+            float32x4_t cube = vmulq_f32(vmulq_f32(x, x), x);
+            vst1q_f32(samples + i, vmlsq_n_f32(x, cube, softClipCubeScale));
+        }
+#endif
+
+        for (; i < count; ++i) {
+            samples[i] = soft_clip_sample(samples[i]);
+        }
+    }
+
+    void interleave(const float *const *channels, float *interleaved, size_t frames, int channelCount) {
+        size_t f = 0;
+
+        if (channelCount == 1) {
+            std::copy(channels[0], channels[0] + frames, interleaved);
+            return;
+        }
+
+        if (channelCount == 2) {
+            const float *left = channels[0];
+            const float *right = channels[1];
+
+#if defined(AUDIO_KERNELS_SSE2)
+            for (; f + 4 <= frames; f += 4) {
+                __m128 l = _mm_loadu_ps(left + f);
+                __m128 r = _mm_loadu_ps(right + f);
+                _mm_storeu_ps(interleaved + f*2, _mm_unpacklo_ps(l, r));     // L0 R0 L1 R1
+                _mm_storeu_ps(interleaved + f*2 + 4, _mm_unpackhi_ps(l, r)); // L2 R2 L3 R3
+            }
+#elif defined(AUDIO_KERNELS_NEON)
+            for (; f + 4 <= frames; f += 4) {
+                float32x4x2_t frame;
+                frame.val[0] = vld1q_f32(left + f);
+                frame.val[1] = vld1q_f32(right + f);
+                vst2q_f32(interleaved + f*2, frame);
+            }
+#endif
+
+            for (; f < frames; ++f) {
+                interleaved[f*2] = left[f];
+                interleaved[f*2 + 1] = right[f];
+            }
+            return;
+        }
+
+        for (; f < frames; ++f) {
+            for (int c = 0; c < channelCount; ++c) {
+                interleaved[f*channelCount + c] = channels[c][f];
+            }
+        }
+    }
+
+    void deinterleave(const float *interleaved, float *const *channels, size_t frames, int channelCount) {
+        size_t f = 0;
+
+        // Stereo is by far the most common layout, so it gets the shuffles.
+        if (channelCount == 2) {
+            float *left = channels[0];
+            float *right = channels[1];
+
+#if defined(AUDIO_KERNELS_SSE2)
+            for (; f + 4 <= frames; f += 4) {
+                __m128 first = _mm_loadu_ps(interleaved + f*2);      // L0 R0 L1 R1
+                __m128 second = _mm_loadu_ps(interleaved + f*2 + 4); // L2 R2 L3 R3
+                _mm_storeu_ps(left + f, _mm_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0)));
+                _mm_storeu_ps(right + f, _mm_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1)));
+            }
+#elif defined(AUDIO_KERNELS_NEON)
+            for (; f + 4 <= frames; f += 4) {
+                float32x4x2_t frame = vld2q_f32(interleaved + f*2);
+                vst1q_f32(left + f, frame.val[0]);
+                vst1q_f32(right + f, frame.val[1]);
+            }
+#endif
+
+            for (; f < frames; ++f) {
+                left[f] = interleaved[f*2];
+                right[f] = interleaved[f*2 + 1];
+            }
+            return;
+        }
+
+        for (; f < frames; ++f) {
+            for (int c = 0; c < channelCount; ++c) {
+                channels[c][f] = interleaved[f*channelCount + c];
+            }
+        }
+    }
+
+} // namespace ORCore
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+
+namespace ORCore {
+
+    // Sample loops shared by the audio streams and outputs. Each has an SSE2 or
+    // NEON path when the target has one, with a scalar loop for the rest.
+
+    // Adds samples scaled by gain to mix.
+    void mix_samples(float *mix, const float *samples, float gain, size_t count);
+
+    // Soft clips samples in place into [-1, 1]. Samples are clamped to ±1.5 and
+    // then shaped with y = x - x³/6.75, which meets ±1 at ±1.5 with zero slope.
+    void soft_clip(float *samples, size_t count);
+
+    // Merges one array per channel into interleaved frames.
+    void interleave(const float *const *channels, float *interleaved, size_t frames, int channelCount);
+
+    // Splits interleaved frames into one array per channel.
+    void deinterleave(const float *interleaved, float *const *channels, size_t frames, int channelCount);
+
+} // namespace ORCore
@@ -1,6 +1,10 @@
 #include "config.hpp"
 #include "soundio.hpp"
+#include "kernels.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <stdexcept>
 
 
@@ -13,6 +17,9 @@
 
 namespace ORCore {
 
+    // How long the producer sleeps when the write callback hasn't woken it.
+    const auto producerWakeInterval = std::chrono::milliseconds(2);
+
     // The reason i seperated these from the class originally, is because they
     // are awful looking functions that clutter up the class definition, and they are really
     // just an implementation detail and they probably shouldn't be shown on documentation.
@@ -88,6 +95,11 @@ namespace ORCore {
             throw std::runtime_error(std::string(_("unable to set channel layout: ")) + soundio_strerror(err));
         }
 
+        // Keep two latencies worth of frames mixed, the backend may have picked
+        // a different latency than the one asked for.
+        int latencyFrames = static_cast<int>(std::ceil(m_outstream->software_latency * m_outstream->sample_rate));
+        start_producer(m_outstream->layout.channel_count, std::max(mixBlockFrames, latencyFrames * 2));
+
         err = soundio_outstream_start(m_outstream);
         if (err) {
             logger->error(_("unable to start device: "), soundio_strerror(err));
@@ -96,6 +108,7 @@ namespace ORCore {
     }
 
     void SoundIoOutput::add_stream(AudioStream *stream) {
+        std::lock_guard<std::mutex> lock(m_streamsMutex);
         m_AudioStreams.push_back(stream);
     }
 
@@ -103,7 +116,83 @@ namespace ORCore {
     void SoundIoOutput::close_stream() {
         if (m_outstream != nullptr) {
             soundio_outstream_destroy(m_outstream);
+            m_outstream = nullptr;
+        }
+        stop_producer();
+    }
+
+    void SoundIoOutput::start_producer(int channelCount, int bufferedFrames) {
+        stop_producer();
+
+        m_bufferedFrames = bufferedFrames;
+        m_mixedBuffer = std::make_unique<AudioRingBuffer>((bufferedFrames + mixBlockFrames) * channelCount);
+        m_dataBuffer.resize(mixBlockFrames * channelCount);
+        m_mixBuffer.resize(mixBlockFrames * channelCount);
+        m_callbackBuffer.resize(mixBlockFrames * channelCount);
+        m_channelPointers.resize(channelCount);
+
+        m_producing = true;
+        m_producer = std::thread(&SoundIoOutput::produce, this, channelCount);
+    }
+
+    void SoundIoOutput::stop_producer() {
+        if (!m_producer.joinable())
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(m_producerMutex);
+            m_producing = false;
+        }
+        m_producerWake.notify_one();
+        m_producer.join();
+    }
+
+    void SoundIoOutput::produce(int channelCount) {
+        int blockSamples = mixBlockFrames * channelCount;
+
+        while (m_producing) {
+            while (m_producing &&
+                   static_cast<int>(m_mixedBuffer->readAvailable()) < m_bufferedFrames * channelCount &&
+                   static_cast<int>(m_mixedBuffer->writeAvailable()) >= blockSamples) {
+                mix_block(channelCount);
+            }
+
+            // The write callback wakes us once it has taken frames, the timeout
+            // only covers a wake up that came in before we started waiting.
+            std::unique_lock<std::mutex> lock(m_producerMutex);
+            if (m_producing) {
+                m_producerWake.wait_for(lock, producerWakeInterval);
+            }
+        }
+    }
+
+    void SoundIoOutput::mix_block(int channelCount) {
+        size_t sampleCount = mixBlockFrames * channelCount;
+        std::fill(m_mixBuffer.begin(), m_mixBuffer.end(), 0.0f);
+
+        {
+            std::lock_guard<std::mutex> lock(m_streamsMutex);
+            auto stream = m_AudioStreams.begin();
+            while (stream != m_AudioStreams.end()) {
+                try {
+                    (*stream)->process(mixBlockFrames);
+                } catch (const std::runtime_error &err) {
+                    logger->error(_("Audio stream failed and was removed: {}"), err.what());
+                    stream = m_AudioStreams.erase(stream);
+                    continue;
+                }
+
+                // A stream that has fallen behind is mixed in as silence for what it is missing.
+                size_t samplesRead = (*stream)->getFilledOutputBuffer()->read(m_dataBuffer.data(), sampleCount);
+                mix_samples(m_mixBuffer.data(), m_dataBuffer.data(), (*stream)->getGain(), samplesRead);
+                ++stream;
+            }
         }
+
+        // Soft clip the samples to remove possible overflows
+        // due to decoding and mixing
+        soft_clip(m_mixBuffer.data(), sampleCount);
+        m_mixedBuffer->write(m_mixBuffer.data(), sampleCount);
     }
 
     void SoundIoOutput::connect_default_output_device() {
@@ -131,56 +220,95 @@ namespace ORCore {
         return m_device;
     };
 
+    int SoundIoOutput::get_channel_count() {
+        if (m_outstream == nullptr)
+            return 0;
+        return m_outstream->layout.channel_count;
+    }
+
     void SoundIoOutput::wait_events() {
         return soundio_wait_events(m_soundio);
     };
 
-    void SoundIoOutput::write_callback(
-        struct SoundIoOutStream *outStream, int frameCountMin, int frameCountMax) {
-
-        const struct SoundIoChannelLayout *layout = &outStream->layout;
-        struct SoundIoChannelArea *areas;
-
-        int min = frameCountMax;
-        for (auto stream: m_AudioStreams) {
-            int framesProcessed = stream->process(frameCountMax);
-            if (framesProcessed != 0)
-                min = framesProcessed;
+    // Copies mixed frames into the device areas, padding with silence if the
+    // mixed buffer runs out. Interleaved areas are read into directly and planar
+    // ones are split with the deinterleave kernel, anything else is copied a sample at a time.
+    void SoundIoOutput::write_areas(SoundIoChannelArea *areas, int channelCount, int frameCount) {
+        const int sampleSize = sizeof(float);
+        bool interleaved = true;
+        bool planar = true;
+        for (int channel = 0; channel < channelCount; ++channel) {
+            interleaved = interleaved && areas[channel].ptr == areas[0].ptr + channel * sampleSize &&
+                          areas[channel].step == channelCount * sampleSize;
+            planar = planar && areas[channel].step == sampleSize;
         }
 
-        int err = soundio_outstream_begin_write(outStream, &areas, &min);
-        if (err) {
-            logger->error(_("{}"), soundio_strerror(err));
-            throw std::runtime_error(_("SoundIO begin write failed"));
+        if (interleaved) {
+            float *out = reinterpret_cast<float*>(areas[0].ptr);
+            size_t sampleCount = frameCount * channelCount;
+            size_t samplesRead = m_mixedBuffer->read(out, sampleCount);
+            std::fill(out + samplesRead, out + sampleCount, 0.0f);
+            return;
         }
 
-        m_dataBuffer.resize(frameCountMax*layout->channel_count);
+        for (int done = 0; done < frameCount; ) {
+            int chunkFrames = std::min(frameCount - done, mixBlockFrames);
+            size_t chunkSamples = chunkFrames * channelCount;
+            size_t samplesRead = m_mixedBuffer->read(m_callbackBuffer.data(), chunkSamples);
+            std::fill(m_callbackBuffer.begin() + samplesRead, m_callbackBuffer.begin() + chunkSamples, 0.0f);
 
-        // Now we copy the data into the outstream !
-        for (int i = 0; i < frameCountMax; ++i) {
-            for (int channel = 0; channel < layout->channel_count; ++channel) {
-                float *ptr = (float*)(areas[channel].ptr + areas[channel].step * i);
-                *ptr = 0;
-                for (auto stream: m_AudioStreams) {
-                    float sample = stream->getFilledOutputBuffer()
-                        ->at(channel + layout->channel_count * i);
-                    *ptr += sample;
+            if (planar) {
+                for (int channel = 0; channel < channelCount; ++channel) {
+                    m_channelPointers[channel] = reinterpret_cast<float*>(areas[channel].ptr) + done;
+                }
+                deinterleave(m_callbackBuffer.data(), m_channelPointers.data(), chunkFrames, channelCount);
+            } else {
+                for (int i = 0; i < chunkFrames; ++i) {
+                    for (int channel = 0; channel < channelCount; ++channel) {
+                        float *ptr = (float*)(areas[channel].ptr + areas[channel].step * (done + i));
+                        *ptr = m_callbackBuffer[channel + channelCount * i];
+                    }
                 }
-                // Pass tanh() to the samples to remove possible overflows
-                // due to decoding and mixing
-                *ptr = tanh(*ptr);
             }
+            done += chunkFrames;
         }
+    }
 
-        for (auto stream: m_AudioStreams) {
-            stream->cleanReadFrames(frameCountMax);
-        }
+    // Runs on the backend's real-time thread, so it only copies what the
+    // producer has already mixed. Nothing here may block, allocate or throw.
+    void SoundIoOutput::write_callback(
+        struct SoundIoOutStream *outStream, int frameCountMin, int frameCountMax) {
 
+        const struct SoundIoChannelLayout *layout = &outStream->layout;
+        struct SoundIoChannelArea *areas;
+        int channelCount = layout->channel_count;
+
+        // Send everything that is ready, padding with silence only when the producer fell behind.
+        int framesReady = static_cast<int>(m_mixedBuffer->readAvailable()) / channelCount;
+        int framesLeft = std::min(frameCountMax, std::max(frameCountMin, framesReady));
+
+        while (framesLeft > 0) {
+            int frameCount = framesLeft;
+            int err = soundio_outstream_begin_write(outStream, &areas, &frameCount);
+            if (err) {
+                logger->error(_("SoundIO begin write failed: {}"), soundio_strerror(err));
+                return;
+            }
+            if (frameCount == 0)
+                break;
+
+            // Now we copy the data into the outstream !
+            write_areas(areas, channelCount, frameCount);
 
-        if ((err = soundio_outstream_end_write(outStream))) {
-            logger->error(_("soundio error : {}\n"), soundio_strerror(err));
-            throw std::runtime_error(_("SoundIO end write failed"));
+            if ((err = soundio_outstream_end_write(outStream))) {
+                logger->error(_("SoundIO end write failed: {}"), soundio_strerror(err));
+                return;
+            }
+            framesLeft -= frameCount;
         }
+
+        // Let the producer top the buffer back up.
+        m_producerWake.notify_one();
     }
 
     void SoundIoOutput::underflow_callback(SoundIoOutStream *outStream) {
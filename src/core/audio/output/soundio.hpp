@@ -3,6 +3,11 @@
 #   define SOUNDIO_STATIC_LIBRARY
 #endif
 #include <soundio/soundio.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "spdlog/spdlog.h"
 
 #include "stream.hpp"
@@ -13,6 +18,9 @@
 #define DEFAULT_SOUNDIO_FORMAT      (SoundIoFormatFloat32NE)
 
 namespace ORCore {
+    // Frames the producer thread mixes at a time.
+    const int mixBlockFrames = 256;
+
     // Singleton class describing the libSoundIO output
     class SoundIoOutput {
     public:
@@ -30,12 +38,15 @@ namespace ORCore {
             open_stream(DEFAULT_SOUNDIO_SAMPLERATE, latency,   DEFAULT_SOUNDIO_FORMAT);
         }
 
+        // Streams are processed on the producer thread from then on.
         void add_stream(AudioStream *stream);
 
         // Closes the stream
         void close_stream();
         void destroy() {
+            stop_producer();
             soundio_destroy(m_soundio);
+            m_soundio = nullptr;
         }
         void flush_events() {
             soundio_flush_events(m_soundio);
@@ -48,6 +59,8 @@ namespace ORCore {
         void disconnect_device();
 
         SoundIoDevice* get_device();
+        // Channels of the open stream, streams added must produce this many.
+        int get_channel_count();
         void wait_events();
 
         void write_callback(SoundIoOutStream *outStream, int frameCountMin, int frameCountMax);
@@ -59,18 +72,43 @@ namespace ORCore {
         // @throws runtime_errors on error
         void initialize();
 
+        // The producer thread decodes, resamples and mixes the streams ahead of
+        // time into m_mixedBuffer, so the write callback only has to copy.
+        void start_producer(int channelCount, int bufferedFrames);
+        void stop_producer();
+        void produce(int channelCount);
+        void mix_block(int channelCount);
+        void write_areas(SoundIoChannelArea *areas, int channelCount, int frameCount);
+
         // The unique libSoundIO instance
         SoundIo             *m_soundio = nullptr;
         // The unique output stream for libSoundIO
-        SoundIoOutStream    *m_outstream;
+        SoundIoOutStream    *m_outstream = nullptr;
         // The unique device instance for libSoundIO
         SoundIoDevice       *m_device = nullptr;
 
-        // The buffer to be sent to the libsoundio backend
+        // Samples read from one stream, and the sum of all the streams.
+        // Only used by the producer thread.
         std::vector<float> m_dataBuffer;
+        std::vector<float> m_mixBuffer;
+
+        // Mixed samples waiting to be sent to the libsoundio backend, and
+        // where the write callback copies them out of it.
+        std::unique_ptr<AudioRingBuffer> m_mixedBuffer;
+        std::vector<float> m_callbackBuffer;
+        std::vector<float*> m_channelPointers;
+        // How far ahead of the backend the producer keeps the mixed buffer
+        int m_bufferedFrames = 0;
+
+        std::thread m_producer;
+        std::atomic<bool> m_producing {false};
+        std::mutex m_producerMutex;
+        std::condition_variable m_producerWake;
 
         // Contains all the streams (song, sounds,…) to play together
+        // Guarded by m_streamsMutex, which the write callback never takes.
         std::vector<AudioStream*> m_AudioStreams;
+        std::mutex m_streamsMutex;
 
         // The spdlogger global instance
         std::shared_ptr<spdlog::logger> logger;
@@ -0,0 +1,128 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace ORCore {
+
+    const size_t cacheLineSize = 64;
+
+    // Fixed capacity single-producer/single-consumer ring buffer.
+    // One thread may write while another reads without any locking, the
+    // storage is allocated once in the constructor so reads and writes
+    // never allocate or move the data already in the buffer.
+    template<typename T>
+    class RingBuffer {
+    public:
+        // The capacity is rounded up to a power of two.
+        explicit RingBuffer(size_t capacity) {
+            size_t size = 1;
+            while (size < capacity) {
+                size <<= 1;
+            }
+            m_data.resize(size);
+            m_mask = size - 1;
+        };
+
+        RingBuffer(const RingBuffer &other) = delete;
+        RingBuffer& operator=(const RingBuffer &other) = delete;
+
+        size_t capacity() const { return m_data.size(); };
+
+        // Items that can be read, only exact when called by the consumer.
+        size_t readAvailable() const {
+            return m_write.load(std::memory_order_acquire) - m_read.load(std::memory_order_relaxed);
+        };
+
+        // Free space that can be written, only exact when called by the producer.
+        size_t writeAvailable() const {
+            return capacity() - (m_write.load(std::memory_order_relaxed) - m_read.load(std::memory_order_acquire));
+        };
+
+        // Producer side. Writes up to count items, returns how many were written.
+        size_t write(const T *data, size_t count) {
+            size_t write = m_write.load(std::memory_order_relaxed);
+            count = std::min(count, writeAvailable());
+            copyIn(write, data, count);
+            m_write.store(write + count, std::memory_order_release);
+            return count;
+        };
+
+        // Producer side. Writes count copies of value, returns how many were written.
+        size_t fill(const T &value, size_t count) {
+            size_t write = m_write.load(std::memory_order_relaxed);
+            count = std::min(count, writeAvailable());
+            for (size_t i = 0; i < count; ++i) {
+                m_data[(write + i) & m_mask] = value;
+            }
+            m_write.store(write + count, std::memory_order_release);
+            return count;
+        };
+
+        // Producer side. Returns the free space at the write cursor that can be
+        // filled in place, count is lowered to how much of it is contiguous.
+        // Nothing is readable until commitWrite is called.
+        T *writeSpan(size_t &count) {
+            size_t start = m_write.load(std::memory_order_relaxed) & m_mask;
+            count = std::min(count, std::min(writeAvailable(), capacity() - start));
+            return m_data.data() + start;
+        };
+
+        // Producer side. Makes count items written through writeSpan readable.
+        void commitWrite(size_t count) {
+            m_write.store(m_write.load(std::memory_order_relaxed) + count, std::memory_order_release);
+        };
+
+        // Consumer side. Copies up to count items out without removing them.
+        size_t peek(T *out, size_t count) const {
+            size_t read = m_read.load(std::memory_order_relaxed);
+            count = std::min(count, readAvailable());
+            copyOut(read, out, count);
+            return count;
+        };
+
+        // Consumer side. Removes up to count items, returns how many were removed.
+        size_t skip(size_t count) {
+            count = std::min(count, readAvailable());
+            m_read.store(m_read.load(std::memory_order_relaxed) + count, std::memory_order_release);
+            return count;
+        };
+
+        // Consumer side. Copies up to count items out and removes them.
+        size_t read(T *out, size_t count) {
+            return skip(peek(out, count));
+        };
+
+    private:
+        // Copies in at most two parts, before and after the end of the storage.
+        void copyIn(size_t position, const T *data, size_t count) {
+            size_t start = position & m_mask;
+            size_t first = std::min(count, capacity() - start);
+            std::copy(data, data + first, m_data.begin() + start);
+            std::copy(data + first, data + count, m_data.begin());
+        };
+
+        void copyOut(size_t position, T *out, size_t count) const {
+            size_t start = position & m_mask;
+            size_t first = std::min(count, capacity() - start);
+            std::copy(m_data.begin() + start, m_data.begin() + start + first, out);
+            std::copy(m_data.begin(), m_data.begin() + (count - first), out + first);
+        };
+
+        std::vector<T> m_data;
+        size_t m_mask;
+
+        // Cursors only ever increase, the index into the storage is the cursor
+        // masked by the capacity. They are padded apart so the producer and the
+        // consumer don't write to the same cache line. Padding is used rather
+        // than alignas as operator new doesn't honour over-alignment before C++17,
+        // and the buffers usually live inside heap allocated streams.
+        char m_padStart[cacheLineSize];
+        std::atomic<size_t> m_write {0};
+        char m_padWrite[cacheLineSize - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> m_read {0};
+        char m_padRead[cacheLineSize - sizeof(std::atomic<size_t>)];
+    };
+
+} // namespace ORCore
@@ -0,0 +1,96 @@
+#include "config.hpp"
+#include "samplebank.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "codecs/vorbis.hpp"
+#include "streams/resample.hpp"
+
+namespace ORCore {
+
+    // Frames pulled through the decoder at a time while loading.
+    const int sampleLoadFrames = 4096;
+
+    SampleBank::SampleBank(int sampleRate, int channelCount)
+    : m_sampleRate(sampleRate),
+      m_channelCount(channelCount) {
+        m_logger = spdlog::get("default");
+    }
+
+    int SampleBank::load(const std::string &filename) {
+        VorbisInput input(filename);
+        input.open();
+
+        try {
+            int inputChannels = input.getChannelCount();
+            if (inputChannels != 1 && inputChannels != m_channelCount) {
+                throw std::runtime_error(_("Sample channel count doesn't match the output."));
+            }
+
+            long frameCount = input.getFrameCount();
+            AudioStream *source = &input;
+
+            // Only resample when the file isn't already at the output rate.
+            std::unique_ptr<ResamplerStream> resampler;
+            if (input.getSampleRate() != m_sampleRate) {
+                resampler = std::make_unique<ResamplerStream>(&input, SRC_SINC_BEST_QUALITY);
+                resampler->setInputSampleRate(input.getSampleRate());
+                resampler->setOutputSampleRate(m_sampleRate);
+                source = resampler.get();
+                frameCount = static_cast<long>(std::ceil(frameCount * static_cast<double>(m_sampleRate) / input.getSampleRate()));
+            }
+
+            auto sample = std::make_shared<AudioSample>();
+            sample->channelCount = m_channelCount;
+            sample->samples.resize(frameCount * m_channelCount);
+
+            AudioBuffer chunk(sampleLoadFrames * inputChannels);
+            long framesDone = 0;
+            while (framesDone < frameCount) {
+                int framesWanted = static_cast<int>(std::min<long>(sampleLoadFrames, frameCount - framesDone));
+                source->process(framesWanted);
+
+                int framesRead = source->getFilledOutputBuffer()->read(chunk.data(), framesWanted * inputChannels) / inputChannels;
+                if (framesRead == 0)
+                    break;
+
+                // Mono samples are played on every channel.
+                float *out = sample->samples.data() + framesDone * m_channelCount;
+                if (inputChannels == m_channelCount) {
+                    std::copy(chunk.begin(), chunk.begin() + framesRead * m_channelCount, out);
+                } else {
+                    for (int f = 0; f < framesRead; ++f) {
+                        std::fill(out + f * m_channelCount, out + (f + 1) * m_channelCount, chunk[f]);
+                    }
+                }
+                framesDone += framesRead;
+            }
+
+            sample->frameCount = static_cast<int>(framesDone);
+            sample->samples.resize(framesDone * m_channelCount);
+            m_samples.push_back(sample);
+            input.close();
+
+            m_logger->debug(_("Loaded sample {} ({} frames)"), filename, framesDone);
+            return static_cast<int>(m_samples.size()) - 1;
+        } catch (...) {
+            input.close();
+            throw;
+        }
+    }
+
+    std::shared_ptr<const AudioSample> SampleBank::get(int id) {
+        return m_samples.at(id);
+    }
+
+    int SampleBank::getSampleRate() {
+        return m_sampleRate;
+    }
+
+    int SampleBank::getChannelCount() {
+        return m_channelCount;
+    }
+
+} // namespace ORCore
@@ -0,0 +1,42 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+#include "stream.hpp"
+
+namespace ORCore {
+
+    // A short sound decoded ahead of time, interleaved at the output's
+    // sample rate and channel count. It never changes once loaded.
+    struct AudioSample {
+        AudioBuffer samples;
+        int channelCount;
+        int frameCount;
+    };
+
+    // Holds the one-shot sounds (hits, misses, crowd…) so they are decoded and
+    // resampled once at load time instead of every time they are played.
+    class SampleBank {
+    public:
+        SampleBank(int sampleRate, int channelCount);
+
+        // Decodes an ogg file, converting it to the bank's format.
+        // Some heavy file access and decoding occurs here !
+        // @return the id to play the sample with
+        int load(const std::string &filename);
+
+        std::shared_ptr<const AudioSample> get(int id);
+        int getSampleRate();
+        int getChannelCount();
+
+    protected:
+        std::shared_ptr<spdlog::logger> m_logger;
+
+        int m_sampleRate;
+        int m_channelCount;
+        std::vector<std::shared_ptr<const AudioSample>> m_samples;
+    };
+
+} // namespace ORCore
@@ -1,11 +1,22 @@
 #pragma once
+#include <atomic>
+#include <cstddef>
 #include <vector>
 
+#include "ringbuffer.hpp"
+
 namespace ORCore {
     // Contains all channels of all samples of the buffer
     // equiv. AudioBuffer[samplesCount][channelsCount]
     using AudioBuffer = std::vector<float>;
 
+    // Interleaved samples passed between two streams, filled by the upstream
+    // and drained by the downstream.
+    using AudioRingBuffer = RingBuffer<float>;
+
+    // Samples each stream can hold ahead of its downstream, 16384 stereo frames.
+    const size_t audioRingBufferSamples = 32768;
+
     // Channels order (Re = Rear, Si = Side)
     // 1: Mono
     // 2: Left   / Right
@@ -21,25 +32,34 @@ namespace ORCore {
     // such as resampling, filtering. It has an input and an output with samples
     class AudioStream {
     public:
-        AudioStream() {};
+        AudioStream()
+        : m_outputBuffer(audioRingBufferSamples) {};
         AudioStream(AudioStream *inputStream)
-        : m_inputStream(inputStream) { };
+        : m_inputStream(inputStream),
+          m_outputBuffer(audioRingBufferSamples) { };
        virtual ~AudioStream() {};
 
-        AudioBuffer *getFilledOutputBuffer() { return &m_outputBuffer; };
+        AudioRingBuffer *getFilledOutputBuffer() { return &m_outputBuffer; };
 
         // Has to be called by the downstream to fill the buffer with frames
-        // before accessing them
+        // before accessing them. Fills at most as many frames as fit in the buffer.
         // @return if this is the end of the stream
         virtual int process(int frameCount) = 0;
 
+        // Frames ready to be read from the output buffer
+        int getFramesInBuffer() {
+            return m_outputBuffer.readAvailable() / getChannelCount();
+        }
+
+        // Frames that can still be written to the output buffer
+        int getFramesFree() {
+            return m_outputBuffer.writeAvailable() / getChannelCount();
+        }
+
         // Has to be called by the downstream to remove
         // the (only used) frames from the output buffer
         void cleanReadFrames(int readFrames) {
-            m_outputBuffer.erase(
-                m_outputBuffer.begin(),
-                m_outputBuffer.begin()+readFrames*getChannelCount());
-            m_framesInBuffer -= readFrames;
+            m_outputBuffer.skip(readFrames*getChannelCount());
         }
 
         // TODO Should not change. Thus, defined in constructor/input setting ?
@@ -52,11 +72,19 @@ namespace ORCore {
             m_inputStream = theInput;
         }
 
+        // Linear gain applied when the stream is mixed, can be changed from any thread.
+        void setGain(float gain) {
+            m_gain = gain;
+        }
+        float getGain() {
+            return m_gain;
+        }
+
 
     protected:
-        AudioStream *m_inputStream;
-        AudioBuffer m_outputBuffer;
-        int m_framesInBuffer = 0;
+        AudioStream *m_inputStream = nullptr;
+        AudioRingBuffer m_outputBuffer;
+        std::atomic<float> m_gain {1.0f};
 
     }; // class AudioStream
 
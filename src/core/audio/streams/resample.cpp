@@ -2,6 +2,7 @@
 #include "resample.hpp"
 #include <fmt/format.h>
 
+#include <algorithm>
 #include <stdexcept>
 
 namespace ORCore {
@@ -13,6 +14,11 @@ namespace ORCore {
         if (!m_src_state) {
             throw std::runtime_error(fmt::format("Failed to init LibSampleRate: {}", src_strerror(error)));
         }
+
+        // libsamplerate works on contiguous frames, the ring buffers are copied
+        // through these so process never has to allocate.
+        m_inputFrames.resize(audioRingBufferSamples);
+        m_resampledFrames.resize(audioRingBufferSamples);
     }
 
     ResamplerStream::~ResamplerStream() {
@@ -29,20 +35,27 @@ namespace ORCore {
     }
 
     int ResamplerStream::process(int frameCount) {
+        int channelCount = getChannelCount();
+        int scratchFrames = m_inputFrames.size() / channelCount;
+        int framesGenerated = 0;
+
+        frameCount = std::min(frameCount, getFramesInBuffer() + getFramesFree());
 
-        // Get a big enough buffer
-        m_outputBuffer.resize(frameCount * getChannelCount());
+        while (getFramesInBuffer() < frameCount) {
+            int framesWanted = std::min(frameCount - getFramesInBuffer(), scratchFrames);
 
-        while (m_framesInBuffer < frameCount) {
             // Ask more frames to the input stream
-            int inputFrameCount = (frameCount - m_framesInBuffer) * sampleRatio + 1;
+            int inputFrameCount = std::min(static_cast<int>(framesWanted / sampleRatio) + 1, scratchFrames);
             m_inputStream->process(inputFrameCount);
 
-            m_src_data.data_in = m_inputStream->getFilledOutputBuffer()->data();
-            m_src_data.input_frames = inputFrameCount;
+            int inputFrames = std::min(m_inputStream->getFramesInBuffer(), scratchFrames);
+            m_inputStream->getFilledOutputBuffer()->peek(m_inputFrames.data(), inputFrames*channelCount);
 
-            m_src_data.data_out= m_outputBuffer.data() + m_framesInBuffer*getChannelCount();
-            m_src_data.output_frames= frameCount - m_framesInBuffer;
+            m_src_data.data_in = m_inputFrames.data();
+            m_src_data.input_frames = inputFrames;
+
+            m_src_data.data_out= m_resampledFrames.data();
+            m_src_data.output_frames= framesWanted;
 
             m_src_data.end_of_input = 0;
             m_src_data.src_ratio    = sampleRatio;
@@ -52,12 +65,17 @@ namespace ORCore {
                 throw std::runtime_error(fmt::format("Failed to init LibSampleRate: {}", src_strerror(error)));
             }
 
-            m_framesInBuffer +=            m_src_data.output_frames_gen;
+            m_outputBuffer.write(m_resampledFrames.data(), m_src_data.output_frames_gen*channelCount);
             m_inputStream->cleanReadFrames(m_src_data.input_frames_used);
+            framesGenerated += m_src_data.output_frames_gen;
 
+            // The input has nothing left to give.
+            if (m_src_data.output_frames_gen == 0 && m_src_data.input_frames_used == 0) {
+                break;
+            }
         }
 
-        return m_src_data.output_frames_gen;
+        return framesGenerated;
     }
 
 
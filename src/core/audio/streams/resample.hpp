@@ -33,6 +33,9 @@ namespace ORCore {
         double samplerate_out= DEFAULT_SAMPLERATE_SAMPLERATE;
         double sampleRatio = samplerate_out / samplerate_in;
 
+        AudioBuffer m_inputFrames;
+        AudioBuffer m_resampledFrames;
+
         SRC_STATE* m_src_state = nullptr;
         SRC_DATA   m_src_data = {
             nullptr,// *data_in,
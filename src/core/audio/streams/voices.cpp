@@ -0,0 +1,80 @@
+#include "config.hpp"
+#include "voices.hpp"
+#include "kernels.hpp"
+
+#include <algorithm>
+
+namespace ORCore {
+
+    VoicePlayer::VoicePlayer(SampleBank &bank, int voiceCount)
+    : m_bank(bank),
+      m_channelCount(bank.getChannelCount()),
+      m_voices(voiceCount),
+      m_triggers(voiceTriggerQueueSize),
+      m_mixBuffer(audioRingBufferSamples) {
+    }
+
+    bool VoicePlayer::play(int sampleId, float gain) {
+        // The bank keeps the sample alive, so only its address has to cross threads.
+        VoiceTrigger trigger {m_bank.get(sampleId).get(), gain};
+        return m_triggers.write(&trigger, 1) == 1;
+    }
+
+    int VoicePlayer::getChannelCount() {
+        return m_channelCount;
+    }
+
+    void VoicePlayer::startVoice(const VoiceTrigger &trigger) {
+        // Take a free voice, or the one that has been playing the longest.
+        Voice *voice = &m_voices[0];
+        for (auto &candidate : m_voices) {
+            if (candidate.sample == nullptr) {
+                voice = &candidate;
+                break;
+            }
+            if (candidate.position > voice->position)
+                voice = &candidate;
+        }
+
+        voice->sample = trigger.sample;
+        voice->position = 0;
+        voice->gain = trigger.gain;
+    }
+
+    int VoicePlayer::process(int frameCount) {
+        VoiceTrigger trigger;
+        while (m_triggers.read(&trigger, 1) == 1) {
+            startVoice(trigger);
+        }
+
+        int mixFrames = m_mixBuffer.size() / m_channelCount;
+        frameCount = std::min(frameCount - getFramesInBuffer(), getFramesFree());
+
+        while (frameCount > 0) {
+            int chunkFrames = std::min(frameCount, mixFrames);
+            std::fill(m_mixBuffer.begin(), m_mixBuffer.begin() + chunkFrames * m_channelCount, 0.0f);
+
+            for (auto &voice : m_voices) {
+                if (voice.sample == nullptr)
+                    continue;
+
+                int framesLeft = voice.sample->frameCount - voice.position;
+                int framesMixed = std::min(chunkFrames, framesLeft);
+                mix_samples(m_mixBuffer.data(),
+                            voice.sample->samples.data() + voice.position * m_channelCount,
+                            voice.gain, framesMixed * m_channelCount);
+
+                voice.position += framesMixed;
+                if (voice.position >= voice.sample->frameCount) {
+                    voice.sample = nullptr;
+                }
+            }
+
+            m_outputBuffer.write(m_mixBuffer.data(), chunkFrames * m_channelCount);
+            frameCount -= chunkFrames;
+        }
+
+        return 0;
+    }
+
+} // namespace ORCore
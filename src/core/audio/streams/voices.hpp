@@ -0,0 +1,57 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+#include "samplebank.hpp"
+#include "stream.hpp"
+
+namespace ORCore {
+
+    // Voices that can play at once, starting one more stops the oldest.
+    const int defaultVoiceCount = 32;
+    // Plays that can be waiting for the next process call.
+    const size_t voiceTriggerQueueSize = 64;
+
+    struct VoiceTrigger {
+        const AudioSample *sample;
+        float gain;
+    };
+
+    struct Voice {
+        const AudioSample *sample = nullptr;
+        int position = 0; // Next frame to play
+        float gain = 1.0f;
+    };
+
+    // Mixes the samples of a SampleBank as they are triggered. Playing a sample
+    // only queues a pointer to its decoded frames, and the voices are allocated
+    // up front, so nothing is decoded or allocated when a sound starts.
+    class VoicePlayer: public AudioStream {
+    public:
+        // The bank must outlive the player, its samples are played in place.
+        VoicePlayer(SampleBank &bank, int voiceCount = defaultVoiceCount);
+
+        // Starts a sample of the bank on the next process call. Only one
+        // thread may play samples, as the queue has a single producer.
+        // @return false if too many plays are already waiting
+        bool play(int sampleId, float gain = 1.0f);
+
+        // @inherit
+        int getChannelCount();
+        // @inherit
+        int process(int frameCount);
+
+    protected:
+        void startVoice(const VoiceTrigger &trigger);
+
+        SampleBank &m_bank;
+        int m_channelCount;
+
+        std::vector<Voice> m_voices;
+        RingBuffer<VoiceTrigger> m_triggers;
+
+        // Where the voices are summed before going to the output buffer.
+        AudioBuffer m_mixBuffer;
+    };
+
+} // namespace ORCore
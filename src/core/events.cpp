@@ -6,6 +6,11 @@
 namespace ORCore
 {
 
+    double get_event_time()
+    {
+        return SDL_GetTicks() / 1000.0;
+    }
+
     // Event Manager methods
 
     void EventManager::add_listener(Listener &listener)
@@ -52,25 +57,28 @@ namespace ORCore
         while (SDL_PollEvent(&sdlEvent)) {
             bool eventProcessed = false;
             Event eventContainer;
+
+            // SDL stamps events when they are queued, so input timing doesn't depend on how often we poll.
+            double eventTime = sdlEvent.common.timestamp / 1000.0;
             if (sdlEvent.type == SDL_QUIT) {
-                eventContainer = Event{Quit, 0.0, QuitEvent{true}};
+                eventContainer = Event{Quit, eventTime, QuitEvent{true}};
                 eventProcessed = true;
             } else if (sdlEvent.type == SDL_MOUSEMOTION) {
-                eventContainer = Event{MouseMove, 0.0, MouseMoveEvent{sdlEvent.motion.x, sdlEvent.motion.y}};
+                eventContainer = Event{MouseMove, eventTime, MouseMoveEvent{sdlEvent.motion.x, sdlEvent.motion.y}};
                 eventProcessed = true;
             } else if (sdlEvent.type == SDL_KEYDOWN) {
-                eventContainer = Event{KeyDown, 0.0, KeyDownEvent{keyMap[sdlEvent.key.keysym.scancode], static_cast<ModFlag>(sdlEvent.key.keysym.mod)}};
+                eventContainer = Event{KeyDown, eventTime, KeyDownEvent{keyMap[sdlEvent.key.keysym.scancode], static_cast<ModFlag>(sdlEvent.key.keysym.mod), sdlEvent.key.repeat != 0}};
                 eventProcessed = true;
             } else if (sdlEvent.type == SDL_KEYUP) {
-                eventContainer = Event{KeyUp, 0.0, KeyUpEvent{keyMap[sdlEvent.key.keysym.scancode], static_cast<ModFlag>(sdlEvent.key.keysym.mod)}};
+                eventContainer = Event{KeyUp, eventTime, KeyUpEvent{keyMap[sdlEvent.key.keysym.scancode], static_cast<ModFlag>(sdlEvent.key.keysym.mod)}};
                 eventProcessed = true;
             } else if (sdlEvent.type == SDL_WINDOWEVENT) {
                 const SDL_WindowEvent winEvent = sdlEvent.window;
                 if (winEvent.event == SDL_WINDOWEVENT_CLOSE) {
-                    eventContainer = Event{WindowClose, 0.0, WindowCloseEvent{winEvent.windowID}};
+                    eventContainer = Event{WindowClose, eventTime, WindowCloseEvent{winEvent.windowID}};
                     eventProcessed = true;
                 } else if (winEvent.event == SDL_WINDOWEVENT_RESIZED) {
-                    eventContainer = Event{WindowSize, 0.0, WindowSizeEvent{winEvent.windowID, winEvent.data1, winEvent.data2}};
+                    eventContainer = Event{WindowSize, eventTime, WindowSizeEvent{winEvent.windowID, winEvent.data1, winEvent.data2}};
                     eventProcessed = true;
                 }
             }
@@ -57,6 +57,8 @@ namespace ORCore
     {
         KeyCode key;
         ModFlag mod;
+        // Set for the repeats sent while a key is held down.
+        bool repeat;
 
     };
 
@@ -76,7 +78,8 @@ namespace ORCore
     struct Event
     {
         EventType type;
-        float time;
+        // Seconds since SDL was initialized, taken from when SDL received the event.
+        double time;
         template<class Type> friend
         Type event_cast(const Event&);
 
@@ -116,7 +119,7 @@ namespace ORCore
         {}
 
         template<typename T>
-        Event(EventType eType, float eTime, const T& event)
+        Event(EventType eType, double eTime, const T& event)
         : type(eType), time(eTime), ptr(new Concrete<T>(event))
         {
         }
@@ -150,6 +153,9 @@ namespace ORCore
         std::unique_ptr<Placeholder> ptr;
     };
 
+    // The current time on the same clock as Event::time, in seconds since SDL was initialized.
+    double get_event_time();
+
     // Used to get the event data out of the event.
     template<typename T>
     T event_cast(const Event& val) {
@@ -0,0 +1,68 @@
+#include "config.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ORCore
+{
+    void parallel_for(size_t count, std::function<void(size_t)> task)
+    {
+        size_t threadCount = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+
+        if (threadCount <= 1)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                task(i);
+            }
+            return;
+        }
+
+        std::atomic<size_t> nextTask {0};
+        std::atomic<bool> failed {false};
+        std::exception_ptr error;
+        std::mutex errorMutex;
+
+        auto worker = [&]()
+        {
+            size_t i;
+            while (!failed && (i = nextTask++) < count)
+            {
+                try {
+                    task(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error)
+                    {
+                        error = std::current_exception();
+                    }
+                    failed = true;
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        threads.reserve(threadCount - 1);
+        for (size_t i = 1; i < threadCount; i++)
+        {
+            threads.emplace_back(worker);
+        }
+
+        worker();
+
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+} // namespace ORCore
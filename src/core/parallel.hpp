@@ -0,0 +1,12 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+
+namespace ORCore
+{
+    // Runs task(i) for every i in [0, count) on a pool of worker threads sized
+    // to the machine. The calling thread works through tasks as well and the
+    // call returns once all of them have finished. If a task throws, no new
+    // tasks are started and the first exception is rethrown to the caller.
+    void parallel_for(size_t count, std::function<void(size_t)> task);
+} // namespace ORCore
@@ -0,0 +1,204 @@
+#include "config.hpp"
+#include "parseutils.hpp"
+
+#include <fstream>
+#include <limits>
+
+#if defined(PLATFORM_WINDOWS)
+    #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+namespace ORCore
+{
+
+    FileBuffer::FileBuffer(const char *buffer, uint32_t length)
+    : data(buffer),
+    size(length),
+    m_mode(FileBufferMode::View)
+    {
+    }
+
+    FileBuffer::FileBuffer(FileBuffer &&other)
+    {
+        *this = std::move(other);
+    }
+
+    FileBuffer& FileBuffer::operator=(FileBuffer &&other)
+    {
+        if (this != &other)
+        {
+            release();
+            data = other.data;
+            position = other.position;
+            size = other.size;
+            m_mode = other.m_mode;
+            m_owned = std::move(other.m_owned);
+
+            other.data = nullptr;
+            other.position = 0;
+            other.size = 0;
+            other.m_mode = FileBufferMode::None;
+        }
+        return *this;
+    }
+
+    FileBuffer::~FileBuffer()
+    {
+        release();
+    }
+
+    void FileBuffer::load(std::string filename)
+    {
+        std::ifstream dataFile(filename, std::ios_base::ate | std::ios_base::binary);
+
+        if (dataFile) {
+            release();
+            auto fileSize = static_cast<uint64_t>(dataFile.tellg());
+            if (fileSize > std::numeric_limits<uint32_t>::max()) {
+                throw std::runtime_error(_("File too large."));
+            }
+            size = static_cast<uint32_t>(fileSize);
+            m_owned = std::make_unique<char[]>(size);
+            dataFile.seekg(0, std::ios::beg);
+
+            dataFile.read(&m_owned[0], size);
+            dataFile.close();
+
+            data = m_owned.get();
+            position = 0;
+            m_mode = FileBufferMode::Owned;
+        } else {
+            throw std::runtime_error(_("Failed to load file."));
+        }
+    }
+
+#if defined(PLATFORM_WINDOWS)
+    void FileBuffer::map(std::string filename)
+    {
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error(_("Failed to load file."));
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart > std::numeric_limits<uint32_t>::max()) {
+            CloseHandle(file);
+            throw std::runtime_error(_("Failed to map file."));
+        }
+
+        release();
+
+        // Zero length files can't be mapped, leave the buffer empty instead.
+        if (fileSize.QuadPart == 0) {
+            CloseHandle(file);
+            return;
+        }
+
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (mapping == nullptr) {
+            throw std::runtime_error(_("Failed to map file."));
+        }
+
+        // The view keeps the mapping alive so the handle can be closed right away.
+        void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (view == nullptr) {
+            throw std::runtime_error(_("Failed to map file."));
+        }
+
+        data = static_cast<const char*>(view);
+        size = static_cast<uint32_t>(fileSize.QuadPart);
+        position = 0;
+        m_mode = FileBufferMode::Mapped;
+    }
+#else
+    void FileBuffer::map(std::string filename)
+    {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw std::runtime_error(_("Failed to load file."));
+        }
+
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) == -1 || static_cast<uint64_t>(fileStat.st_size) > std::numeric_limits<uint32_t>::max()) {
+            close(fd);
+            throw std::runtime_error(_("Failed to map file."));
+        }
+
+        release();
+
+        // Zero length files can't be mapped, leave the buffer empty instead.
+        if (fileStat.st_size == 0) {
+            close(fd);
+            return;
+        }
+
+        // The mapping holds its own reference to the file so the fd can be closed right away.
+        void *view = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (view == MAP_FAILED) {
+            throw std::runtime_error(_("Failed to map file."));
+        }
+
+        // We parse front to back, so let the kernel read ahead aggressively.
+        madvise(view, fileStat.st_size, MADV_SEQUENTIAL);
+
+        data = static_cast<const char*>(view);
+        size = static_cast<uint32_t>(fileStat.st_size);
+        position = 0;
+        m_mode = FileBufferMode::Mapped;
+    }
+#endif
+
+    FileBufferMode FileBuffer::get_mode()
+    {
+        return m_mode;
+    }
+
+    uint32_t FileBuffer::get_pos()
+    {
+        return position;
+    }
+
+    void FileBuffer::set_pos(uint32_t pos)
+    {
+        position = pos;
+    }
+
+    void FileBuffer::set_pos_rel(uint32_t pos)
+    {
+        position += pos;
+    }
+
+    uint32_t FileBuffer::get_size()
+    {
+        return size;
+    }
+
+    void FileBuffer::release()
+    {
+        if (m_mode == FileBufferMode::Mapped)
+        {
+#if defined(PLATFORM_WINDOWS)
+            UnmapViewOfFile(data);
+#else
+            munmap(const_cast<char*>(data), size);
+#endif
+        }
+        m_owned.reset();
+        data = nullptr;
+        position = 0;
+        size = 0;
+        m_mode = FileBufferMode::None;
+    }
+} // namespace ORCore
@@ -1,160 +1,332 @@
 #pragma once
 #include "config.hpp"
-#include <fstream>
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <memory>
 #include <stdexcept>
 
+#if defined(_MSC_VER)
+    #include <stdlib.h>
+#endif
 
 namespace ORCore
 {
     // TODO - Could be useful to move into the VFS at some point.
-    // Also in the future we can have an alternative memory mapped file
-    // implementation when speed is less important than memory usage.
-    // This is just mainly a basic starting point.
+    enum class FileBufferMode
+    {
+        None,
+        Owned,  // Heap copy of the file made by load()
+        Mapped, // Read-only memory map of the file made by map()
+        View,   // Memory owned by the caller, never freed by the buffer.
+    };
+
+    // A FileBuffer can hold its data in three ways. load() makes a heap copy
+    // of the file, map() maps the file read-only so parsing reads straight
+    // from the page cache, and the span constructor wraps memory the caller
+    // already owns. Readers only ever see data/position/size.
     struct FileBuffer
     {
-        std::unique_ptr<char[]> data;
+        const char *data = nullptr;
         uint32_t position = 0;
         uint32_t size = 0;
 
-        void load(std::string filename)
-        {
-            std::ifstream dataFile(filename, std::ios_base::ate | std::ios_base::binary);
-
-            if (dataFile) {
-                size = dataFile.tellg();
-                data = std::make_unique<char[]>(size);
-                dataFile.seekg(0, std::ios::beg);
+        FileBuffer() = default;
+        FileBuffer(const char *buffer, uint32_t length);
+        FileBuffer(FileBuffer &&other);
+        FileBuffer& operator=(FileBuffer &&other);
+        FileBuffer(const FileBuffer &other) = delete;
+        FileBuffer& operator=(const FileBuffer &other) = delete;
+        ~FileBuffer();
 
-                dataFile.read(&data[0], size);
-                dataFile.close();
-            } else {
-                throw std::runtime_error(_("Failed to load file."));
-            }
-        }
-        uint32_t get_pos() {
-            return position;
-        }
-        void set_pos(uint32_t pos) {
-            position = pos;
-        }
-        void set_pos_rel(uint32_t pos) {
-            position += pos;
-        }
-        uint32_t get_size() {
-            return size;
-        }
+        void load(std::string filename);
+        void map(std::string filename);
+        FileBufferMode get_mode();
+        uint32_t get_pos();
+        void set_pos(uint32_t pos);
+        void set_pos_rel(uint32_t pos);
+        uint32_t get_size();
+        void release();
 
-        void release()
-        {
-            data.reset();
-        }
+    private:
+        FileBufferMode m_mode = FileBufferMode::None;
+        std::unique_ptr<char[]> m_owned;
     };
 
-    // Custom FileBuffer based reading.
-    template<typename T>
-    T read_type(FileBuffer &fileData)
+    // Byte swapping helpers, these compile down to a single bswap/rev instruction.
+    inline uint8_t byte_swap(uint8_t value)
     {
-        T output;
-        size_t size = sizeof(T);
+        return value;
+    }
 
-        char *outPtr = reinterpret_cast<char*>(&output);
-        char *inPtr = &fileData.data[fileData.position];
+    inline uint16_t byte_swap(uint16_t value)
+    {
+#if defined(_MSC_VER)
+        return _byteswap_ushort(value);
+#else
+        return __builtin_bswap16(value);
+#endif
+    }
 
-        for(size_t i = 0; i < size; i++) {
-            outPtr[i] = inPtr[size-1 - i];
-        }
-        fileData.position += size;
+    inline uint32_t byte_swap(uint32_t value)
+    {
+#if defined(_MSC_VER)
+        return _byteswap_ulong(value);
+#else
+        return __builtin_bswap32(value);
+#endif
+    }
+
+    inline uint64_t byte_swap(uint64_t value)
+    {
+#if defined(_MSC_VER)
+        return _byteswap_uint64(value);
+#else
+        return __builtin_bswap64(value);
+#endif
+    }
+
+    template<size_t size> struct UintOfSize;
+    template<> struct UintOfSize<1> { using type = uint8_t; };
+    template<> struct UintOfSize<2> { using type = uint16_t; };
+    template<> struct UintOfSize<4> { using type = uint32_t; };
+    template<> struct UintOfSize<8> { using type = uint64_t; };
+
+    // Load a big endian value of type T from unaligned memory.
+    template<typename T>
+    T load_be(const void *ptr)
+    {
+        using UintType = typename UintOfSize<sizeof(T)>::type;
+        UintType value;
+        std::memcpy(&value, ptr, sizeof(T));
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        value = byte_swap(value);
+#endif
+        T output;
+        std::memcpy(&output, &value, sizeof(T));
         return output;
     }
 
+    // Load a big endian unsigned value that is narrower than its container (for example 24 bit tempos).
     template<typename T>
-    T read_type(FileBuffer &fileData, size_t size)
+    T load_be(const void *ptr, size_t size)
     {
+        auto inPtr = static_cast<const uint8_t*>(ptr);
         T output = 0;
-        if (sizeof(output) < size)
-        {
-            throw std::runtime_error(_("Size greater than container type"));
-        } else {
-            char *outPtr = reinterpret_cast<char*>(&output);
-            char *inPtr = &fileData.data[fileData.position];
-
-            for(size_t i = 0; i < size; i++) {
-                outPtr[i] = inPtr[size-1 - i];
-            }
-            fileData.position += size;
+        for (size_t i = 0; i < size; i++) {
+            output = static_cast<T>((output << 8) | inPtr[i]);
         }
         return output;
     }
 
-    // Main purpose is for reading string-like data from the file.
+    // Store value as big endian into unaligned memory.
     template<typename T>
-    void read_type(FileBuffer &fileData, T *output, unsigned long length)
+    void store_be(void *ptr, T value)
     {
-        size_t size = sizeof(T);
-
-        char *outPtr = reinterpret_cast<char*>(output);
-        char *inPtr;
+        using UintType = typename UintOfSize<sizeof(T)>::type;
+        UintType output;
+        std::memcpy(&output, &value, sizeof(T));
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        output = byte_swap(output);
+#endif
+        std::memcpy(ptr, &output, sizeof(T));
+    }
 
-        for (size_t j = 0; j < length; j++) {
-            inPtr = &fileData.data[fileData.position];
-            for(size_t i = 0; i < size; i++) {
-                outPtr[i] = inPtr[size-1 - i];
-            }
-            outPtr += size;
-            fileData.position += size;
+    inline void check_bounds(FileBuffer &fileData, size_t size)
+    {
+        if (fileData.position > fileData.size || size > fileData.size - fileData.position)
+        {
+            throw std::runtime_error(_("Unexpected end of file."));
         }
     }
 
+    // Custom FileBuffer based reading, all reads are bounds checked against the buffer size.
     template<typename T>
     T peek_type(FileBuffer &fileData)
     {
-        T output;
-        size_t size = sizeof(T);
-
-        char *outPtr = reinterpret_cast<char*>(&output);
-        char *inPtr = &fileData.data[fileData.position];
-
-        for(size_t i = 0; i < size; i++) {
-            outPtr[i] = inPtr[size-1 - i];
-        }
-        return output;
+        check_bounds(fileData, sizeof(T));
+        return load_be<T>(&fileData.data[fileData.position]);
     }
 
     template<typename T>
     T peek_type(FileBuffer &fileData, size_t size)
     {
-        T output = 0;
-        if (sizeof(output) < size)
+        if (sizeof(T) < size)
         {
             throw std::runtime_error(_("Size greater than container type"));
-        } else {
-            char *outPtr = reinterpret_cast<char*>(&output);
-            char *inPtr = &fileData.data[fileData.position];
+        }
+        check_bounds(fileData, size);
+        return load_be<T>(&fileData.data[fileData.position], size);
+    }
 
-            for(size_t i = 0; i < size; i++) {
-                outPtr[i] = inPtr[size-1 - i];
+    // Main purpose is for reading string-like data from the file.
+    template<typename T>
+    void peek_type(FileBuffer &fileData, T *output, unsigned long length)
+    {
+        check_bounds(fileData, sizeof(T) * length);
+        const char *inPtr = &fileData.data[fileData.position];
+
+        if (sizeof(T) == 1) {
+            std::memcpy(output, inPtr, length);
+        } else {
+            for (size_t j = 0; j < length; j++) {
+                output[j] = load_be<T>(inPtr + (sizeof(T) * j));
             }
         }
+    }
+
+    template<typename T>
+    T read_type(FileBuffer &fileData)
+    {
+        T output = peek_type<T>(fileData);
+        fileData.position += sizeof(T);
+        return output;
+    }
+
+    template<typename T>
+    T read_type(FileBuffer &fileData, size_t size)
+    {
+        T output = peek_type<T>(fileData, size);
+        fileData.position += size;
         return output;
     }
 
     // Main purpose is for reading string-like data from the file.
     template<typename T>
-    void peek_type(FileBuffer &fileData, T *output, unsigned long length)
+    void read_type(FileBuffer &fileData, T *output, unsigned long length)
     {
-        size_t size = sizeof(T);
+        peek_type<T>(fileData, output, length);
+        fileData.position += sizeof(T) * length;
+    }
+
+    // Cursor over a single chunk of a FileBuffer, used by the hot parsing loops.
+    //
+    // The chunk range is validated against the buffer once when the reader is
+    // created. After that callers check remaining() once per record and use the
+    // unchecked *_fast reads, only falling back to the checked reads for the
+    // last few bytes of a chunk where a truncated record could run off the end.
+    struct ChunkReader
+    {
+        const uint8_t *begin;
+        const uint8_t *pos;
+        const uint8_t *end;
 
-        char *outPtr = reinterpret_cast<char*>(output);
-        char *inPtr;
+        ChunkReader(FileBuffer &fileData, uint32_t start, uint32_t length);
 
-        for (size_t j = 0; j < length; j++) {
-            inPtr = &fileData.data[fileData.position+(size*j)];
-            for(size_t i = 0; i < size; i++) {
-                outPtr[i] = inPtr[size-1 - i];
-            }
-            outPtr += size;
+        size_t remaining();
+        uint32_t offset();
+        void require(size_t size);
+        void skip(size_t size);
+
+        uint8_t peek_u8();
+        uint8_t read_u8();
+        uint8_t read_u8_fast();
+        uint32_t read_var_len();
+        uint32_t read_var_len_fast();
+    };
+
+    // The longest channel event is a 4 byte delta, a status byte and 2 data bytes.
+    // With at least this much left in a chunk an event can be decoded unchecked.
+    const size_t smfMaxEventHeader = 7;
+
+    inline ChunkReader::ChunkReader(FileBuffer &fileData, uint32_t start, uint32_t length)
+    {
+        if (start > fileData.size || length > fileData.size - start)
+        {
+            throw std::runtime_error(_("Chunk extends past end of file."));
         }
+        begin = reinterpret_cast<const uint8_t*>(fileData.data) + start;
+        pos = begin;
+        end = begin + length;
     }
+
+    inline size_t ChunkReader::remaining()
+    {
+        return end - pos;
+    }
+
+    // Offset from the start of the chunk.
+    inline uint32_t ChunkReader::offset()
+    {
+        return static_cast<uint32_t>(pos - begin);
+    }
+
+    inline void ChunkReader::require(size_t size)
+    {
+        if (size > remaining())
+        {
+            throw std::runtime_error(_("Unexpected end of chunk."));
+        }
+    }
+
+    inline void ChunkReader::skip(size_t size)
+    {
+        require(size);
+        pos += size;
+    }
+
+    inline uint8_t ChunkReader::peek_u8()
+    {
+        require(1);
+        return *pos;
+    }
+
+    inline uint8_t ChunkReader::read_u8()
+    {
+        require(1);
+        return *pos++;
+    }
+
+    inline uint8_t ChunkReader::read_u8_fast()
+    {
+        return *pos++;
+    }
+
+    // Variable length quantities are at most 4 bytes in a SMF. Nearly all delta
+    // times fit in 1 or 2 bytes so those are decoded without a loop. This does
+    // no bounds checking, the caller must know 4 bytes are readable.
+    inline uint32_t decode_var_len(const uint8_t *&pos)
+    {
+        uint32_t c = *pos++;
+        if ((c & 0x80) == 0) {
+            return c;
+        }
+        uint32_t value = c & 0x7F;
+        c = *pos++;
+        value = (value << 7) | (c & 0x7F);
+        if ((c & 0x80) == 0) {
+            return value;
+        }
+        c = *pos++;
+        value = (value << 7) | (c & 0x7F);
+        if ((c & 0x80) == 0) {
+            return value;
+        }
+        c = *pos++;
+        if ((c & 0x80) != 0) {
+            throw std::runtime_error(_("Variable length value longer than 4 bytes."));
+        }
+        return (value << 7) | c;
+    }
+
+    inline uint32_t ChunkReader::read_var_len_fast()
+    {
+        return decode_var_len(pos);
+    }
+
+    inline uint32_t ChunkReader::read_var_len()
+    {
+        if (remaining() >= 4) {
+            return read_var_len_fast();
+        }
+
+        uint32_t value = 0;
+        uint8_t c;
+        do {
+            c = read_u8();
+            value = (value << 7) | (c & 0x7F);
+        } while (c & 0x80);
+        return value;
+    }
+
 } // namespace ORCore
@@ -1,7 +1,21 @@
 #include "config.hpp"
 #include "smf.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #endif
+    #define SMF_SCAN_SSE2
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+    #define SMF_SCAN_NEON
+#endif
+
 namespace ORCore
 {
 
@@ -10,20 +24,34 @@ namespace ORCore
     {
         m_logger->info(_("Loading MIDI"));
 
+        // Map the file rather than copying it, the parser then reads straight from the page cache.
         try {
-            m_smfFile.load(filename);
+            m_smfFile.map(filename);
         } catch (std::runtime_error &err) {
             throw std::runtime_error(_("Failed to load MIDI file."));
         }
 
-        m_logger->info(_("Parsing midi."));
+        parse();
+    }
 
-        read_file();
-        m_smfFile.release();
+    SmfReader::SmfReader(const char *smfData, uint32_t size)
+    :m_smfFile(smfData, size),
+    m_logger(spdlog::get("default"))
+    {
+        m_logger->info(_("Loading MIDI from memory"));
+        parse();
     }
 
     std::vector<SmfTrack*> SmfReader::get_tracks()
     {
+        std::vector<size_t> pending;
+        for (size_t i = 0; i < m_trackChunks.size(); i++) {
+            if (!m_trackChunks[i].decoded) {
+                pending.push_back(i);
+            }
+        }
+        decode_tracks(pending);
+
         std::vector<SmfTrack*> tracks;
 
         for (auto &track : m_tracks) {
@@ -31,6 +59,106 @@ namespace ORCore
         }
         return tracks;
     }
+
+    // Returns the first track with the given name or nullptr if there is none.
+    SmfTrack* SmfReader::get_track(std::string name)
+    {
+        for (size_t i = 0; i < m_trackChunks.size(); i++) {
+            if (m_trackChunks[i].name == name) {
+                if (!m_trackChunks[i].decoded) {
+                    std::vector<size_t> pending {i};
+                    decode_tracks(pending);
+                }
+                return &m_tracks[i];
+            }
+        }
+        return nullptr;
+    }
+
+    std::vector<std::string> SmfReader::get_track_names()
+    {
+        std::vector<std::string> names;
+
+        for (auto &trackChunk : m_trackChunks) {
+            names.push_back(trackChunk.name);
+        }
+        return names;
+    }
+
+    // Decodes a track into a track of its own rather than the reader's, the
+    // context says where its channel events go.
+    SmfTrack SmfReader::read_detached_track(size_t index, SmfTrackContext &context)
+    {
+        if (index >= m_trackChunks.size())
+        {
+            throw std::out_of_range(_("Invalid track index."));
+        }
+
+        SmfTrack track {};
+        track.name = m_trackChunks[index].name;
+
+        // Tempo changes in the first track are already part of the tempo map.
+        SmfTrackChunk trackChunk = m_trackChunks[index];
+        context.track = &track;
+        read_track(trackChunk, context);
+        if (index != 0)
+        {
+            check_tempo_changes(context);
+        }
+        return track;
+    }
+
+    size_t SmfReader::find_track_index(std::string name)
+    {
+        for (size_t i = 0; i < m_trackChunks.size(); i++) {
+            if (m_trackChunks[i].name == name) {
+                return i;
+            }
+        }
+        throw std::out_of_range(_("No track named ") + name);
+    }
+
+    SmfTrack SmfReader::visit_track(size_t index, const SmfVisitor &visitor)
+    {
+        SmfEventVisitor eventVisitor {visitor, m_tempoSegments, 0};
+
+        SmfTrackContext context;
+        context.visitor = &eventVisitor;
+        return read_detached_track(index, context);
+    }
+
+    SmfTrack SmfReader::visit_track(std::string name, const SmfVisitor &visitor)
+    {
+        return visit_track(find_track_index(name), visitor);
+    }
+
+    SmfTrack SmfReader::read_event_arrays(size_t index, SmfEventArrays &arrays)
+    {
+        arrays = SmfEventArrays();
+
+        SmfTrackContext context;
+        context.arrays = &arrays;
+        return read_detached_track(index, context);
+    }
+
+    SmfTrack SmfReader::read_event_arrays(std::string name, SmfEventArrays &arrays)
+    {
+        return read_event_arrays(find_track_index(name), arrays);
+    }
+
+    std::string SmfReader::get_text(SmfDataView view)
+    {
+        return std::string(get_data(view), view.length);
+    }
+
+    const char* SmfReader::get_data(SmfDataView view)
+    {
+        if (view.offset > m_smfFile.get_size() || view.length > m_smfFile.get_size() - view.offset)
+        {
+            throw std::out_of_range(_("Event data is outside of the midi file."));
+        }
+        return m_smfFile.data + view.offset;
+    }
     TempoTrack* SmfReader::get_tempo_track()
     {
         return &m_tempoTrack;
@@ -38,77 +166,267 @@ namespace ORCore
     
     void SmfReader::release()
     {
-        m_tracks.clear();
+        // Swap with empty vectors so the capacity is freed, not just the elements.
+        std::vector<SmfTrack>().swap(m_tracks);
+        std::vector<SmfTrackChunk>().swap(m_trackChunks);
+        std::vector<TempoSegment>().swap(m_tempoSegments);
+        m_tempoTrack = TempoTrack();
+        m_smfFile.release();
+    }
+
+    template<typename T>
+    static size_t vector_bytes(const std::vector<T> &items)
+    {
+        return items.capacity() * sizeof(T);
     }
 
-    uint32_t SmfReader::read_var_len()
+    size_t SmfReader::retained_bytes()
     {
-        uint8_t c = read_type<uint8_t>(m_smfFile);
-        uint32_t value = static_cast<uint32_t>(c & 0x7F);
+        size_t bytes = m_smfFile.get_size();
+        bytes += vector_bytes(m_tempoTrack.tempo) + vector_bytes(m_tempoTrack.timeSignature) + vector_bytes(m_tempoTrack.tempoOrdering);
+        bytes += vector_bytes(m_tempoSegments) + vector_bytes(m_trackChunks);
+
+        for (auto &chunk : m_trackChunks)
+        {
+            bytes += chunk.name.capacity();
+        }
+        for (auto &track : m_tracks)
+        {
+            bytes += sizeof(SmfTrack) + track.name.capacity();
+            bytes += vector_bytes(track.midiEvents) + vector_bytes(track.textEvents) + vector_bytes(track.miscMeta);
+        }
+        return bytes;
+    }
 
-        if (c & 0x80) {
+    // Number of data bytes following a channel message, indexed by the high nibble of the status byte.
+    // NoteOff, NoteOn, KeyPressure, ControlChange and PitchBend carry 2 bytes, ProgramChange and ChannelPressure 1.
+    static const uint8_t channelDataLength[8] = {2, 2, 2, 2, 1, 1, 2, 0};
 
-            do {
-                c = read_type<uint8_t>(m_smfFile);
-                value = (value << 7) + (c & 0x7F);
+    // NoteOff (0x8n) and NoteOn (0x9n) are the only statuses with 0x80 in the top three bits.
+    static inline bool is_note_in_range(uint8_t status, uint8_t data1, uint8_t low, uint8_t span)
+    {
+        return (status & 0xE0) == 0x80 && static_cast<uint8_t>(data1 - low) <= span;
+    }
 
-            } while (c & 0x80);
+#if defined(SMF_SCAN_SSE2)
+    static inline unsigned int lowest_set_bit(unsigned int mask)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return index;
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+#endif
 
+    void find_note_events(const SmfEventArrays &events, uint8_t low, uint8_t high, std::vector<uint32_t> &indices)
+    {
+        const uint8_t *status = events.status.data();
+        const uint8_t *data1 = events.data1.data();
+        size_t count = events.size();
+        uint8_t span = high - low;
+        size_t i = 0;
+
+        // Both checks are done on 16 events at once, the range check as a single
+        // unsigned compare of (data1 - low) against the width of the range.
+#if defined(SMF_SCAN_SSE2)
+        const __m128i noteMask = _mm_set1_epi8(static_cast<char>(0xE0));
+        const __m128i noteValue = _mm_set1_epi8(static_cast<char>(0x80));
+        const __m128i lowValue = _mm_set1_epi8(static_cast<char>(low));
+        const __m128i spanValue = _mm_set1_epi8(static_cast<char>(span));
+
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i statusBlock = _mm_loadu_si128(reinterpret_cast<const __m128i*>(status + i));
+            __m128i data1Block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data1 + i));
+
+            __m128i isNote = _mm_cmpeq_epi8(_mm_and_si128(statusBlock, noteMask), noteValue);
+            __m128i offset = _mm_sub_epi8(data1Block, lowValue);
+            __m128i inRange = _mm_cmpeq_epi8(_mm_min_epu8(offset, spanValue), offset);
+
+            unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_and_si128(isNote, inRange)));
+            while (mask != 0)
+            {
+                unsigned int bit = lowest_set_bit(mask);
+                indices.push_back(static_cast<uint32_t>(i + bit));
+                mask &= mask - 1;
+            }
+        }
+#elif defined(SMF_SCAN_NEON)
+        const uint8x16_t noteMask = vdupq_n_u8(0xE0);
+        const uint8x16_t noteValue = vdupq_n_u8(0x80);
+        const uint8x16_t lowValue = vdupq_n_u8(low);
+        const uint8x16_t spanValue = vdupq_n_u8(span);
+
+        for (; i + 16 <= count; i += 16)
+        {
+            uint8x16_t statusBlock = vld1q_u8(status + i);
+            uint8x16_t data1Block = vld1q_u8(data1 + i);
+
+            uint8x16_t isNote = vceqq_u8(vandq_u8(statusBlock, noteMask), noteValue);
+            uint8x16_t inRange = vcleq_u8(vsubq_u8(data1Block, lowValue), spanValue);
+            uint8x16_t matches = vandq_u8(isNote, inRange);
+
+            // Narrow each lane to 4 bits so the whole block fits in a 64 bit mask.
+            uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+            while (mask != 0)
+            {
+                unsigned int bit = __builtin_ctzll(mask);
+                indices.push_back(static_cast<uint32_t>(i + bit / 4));
+                mask &= ~(0xFull << (bit & ~3u));
+            }
+        }
+#endif
+
+        for (; i < count; i++)
+        {
+            if (is_note_in_range(status[i], data1[i], low, span))
+            {
+                indices.push_back(static_cast<uint32_t>(i));
+            }
         }
-        return value;
     }
 
-    void SmfReader::read_midi_event(SmfEventInfo &event)
+    // Appends a channel event to whichever storage the reader was asked to fill.
+    static inline void push_midi_event(std::vector<MidiEvent> &midiEvents, uint8_t status, uint32_t pulseTime, uint8_t data1, uint8_t data2)
     {
-        MidiEvent midiEvent;
-        midiEvent.info = event;
-        midiEvent.message = static_cast<MidiChannelMessage>(event.status & 0xF0);
-        midiEvent.channel = static_cast<uint8_t>(event.status & 0xF);
+        // Filling the event in place is noticeably faster than pushing a temporary.
+        midiEvents.emplace_back();
+        MidiEvent &midiEvent = midiEvents.back();
+        midiEvent.pulseTime = pulseTime;
+        midiEvent.status = status;
+        midiEvent.data1 = data1;
+        midiEvent.data2 = data2;
+    }
 
-        switch (midiEvent.message) {
-            case NoteOff:      // note off           (2 more bytes)
-            case NoteOn:       // note on            (2 more bytes)
-                midiEvent.data1 = read_type<uint8_t>(m_smfFile); // note
-                midiEvent.data2 = read_type<uint8_t>(m_smfFile); // velocity
-                break;
-            case KeyPressure:
-                midiEvent.data1 = read_type<uint8_t>(m_smfFile); // note
-                midiEvent.data2 = read_type<uint8_t>(m_smfFile); // pressure
-                break;
-            case ControlChange:
-                midiEvent.data1 = read_type<uint8_t>(m_smfFile); // controller
-                midiEvent.data2 = read_type<uint8_t>(m_smfFile); // cont_value
-                break;
-            case ProgramChange:
-                midiEvent.data1 = read_type<uint8_t>(m_smfFile); // program
-                midiEvent.data2 = 0; // no data
-                break;
-            case ChannelPressure:
-                midiEvent.data1 = read_type<uint8_t>(m_smfFile); // pressure
-                midiEvent.data2 = 0; // no data
-                break;
-            case PitchBend:
-                midiEvent.data1 = read_type<uint8_t>(m_smfFile); // pitch_low
-                midiEvent.data2 = read_type<uint8_t>(m_smfFile); // pitch_high
-                break;
-            default:
-                m_logger->warn(_("Bad Midi control message"));
+    static inline void push_midi_event(SmfEventArrays &midiEvents, uint8_t status, uint32_t pulseTime, uint8_t data1, uint8_t data2)
+    {
+        midiEvents.pulseTime.push_back(pulseTime);
+        midiEvents.status.push_back(status);
+        midiEvents.data1.push_back(data1);
+        midiEvents.data2.push_back(data2);
+    }
+
+    static inline void push_midi_event(SmfEventVisitor &midiEvents, uint8_t status, uint32_t pulseTime, uint8_t data1, uint8_t data2)
+    {
+        auto &segments = midiEvents.tempoSegments;
+        while (midiEvents.segment + 1 < segments.size() && segments[midiEvents.segment + 1].pulseTime <= pulseTime)
+        {
+            midiEvents.segment++;
+        }
+        const TempoSegment &segment = segments[midiEvents.segment];
+
+        SmfVisitEvent event;
+        event.pulseTime = pulseTime;
+        event.time = segment.absTime + ((pulseTime - segment.pulseTime) * segment.timePerTick);
+        event.status = status;
+        event.data1 = data1;
+        event.data2 = data2;
+        midiEvents.visitor(event);
+    }
+
+    // Counts the channel events in a chunk without decoding them, so storage can
+    // be reserved exactly. Stops at the first malformed event, the decoder reports it.
+    static size_t count_midi_events(ChunkReader chunk)
+    {
+        size_t count = 0;
+        uint8_t prevStatus = 0;
+
+        try {
+            while (chunk.remaining() > 0)
+            {
+                chunk.read_var_len();
+                uint8_t status = chunk.peek_u8();
+
+                if (status == status_MetaEvent) {
+                    chunk.skip(1);
+                    chunk.read_u8(); // meta type
+                    chunk.skip(chunk.read_var_len());
+                    prevStatus = 0;
+                } else if (status == status_SysexEvent || status == status_SysexEvent2) {
+                    chunk.skip(1);
+                    chunk.skip(chunk.read_var_len());
+                    prevStatus = 0;
+                } else {
+                    if (status & 0x80) {
+                        chunk.skip(1);
+                    } else if (prevStatus != 0) {
+                        status = prevStatus;
+                    } else {
+                        break;
+                    }
+                    chunk.skip(channelDataLength[(status >> 4) & 0x7]);
+                    prevStatus = status;
+                    if (status < 0xF0) {
+                        count++;
+                    }
+                }
+            }
+        } catch (std::runtime_error &err) {
         }
+        return count;
+    }
 
-        m_currentTrack->midiEvents.push_back(midiEvent);
+    static void reserve_midi_events(std::vector<MidiEvent> &midiEvents, ChunkReader &chunk)
+    {
+        midiEvents.reserve(count_midi_events(chunk));
     }
 
-    void SmfReader::read_meta_event(SmfEventInfo &eventInfo)
+    static void reserve_midi_events(SmfEventArrays &midiEvents, ChunkReader &chunk)
     {
-        MetaEvent event {eventInfo, read_type<MidiMetaEvent>(m_smfFile), read_var_len()};
+        size_t count = count_midi_events(chunk);
+        midiEvents.pulseTime.reserve(count);
+        midiEvents.status.reserve(count);
+        midiEvents.data1.reserve(count);
+        midiEvents.data2.reserve(count);
+    }
+
+    // Nothing is stored for a visitor.
+    static void reserve_midi_events(SmfEventVisitor &midiEvents, ChunkReader &chunk)
+    {
+    }
+
+    // Reads the data bytes of a channel event, returns false if the status isn't a channel message.
+    bool SmfReader::read_midi_event(ChunkReader &chunk, SmfEventInfo &event, uint8_t &data1, uint8_t &data2)
+    {
+        if ((event.status & 0x80) == 0 || event.status >= 0xF0)
+        {
+            m_logger->warn(_("Bad Midi control message"));
+            return false;
+        }
+
+        uint8_t length = channelDataLength[(event.status >> 4) & 0x7];
+        chunk.require(length);
+
+        data1 = chunk.pos[0];
+        data2 = length > 1 ? chunk.pos[1] : 0;
+        chunk.pos += length;
+        return true;
+    }
+
+    void SmfReader::read_meta_event(ChunkReader &chunk, SmfTrackContext &context, SmfEventInfo &eventInfo)
+    {
+        MetaEvent event {eventInfo, static_cast<MidiMetaEvent>(chunk.read_u8()), chunk.read_var_len()};
+
+        // Bounds check the whole payload once, the fields below are then read straight from it.
+        chunk.require(event.length);
+        const uint8_t *payload = chunk.pos;
+        const char *text = reinterpret_cast<const char*>(payload);
+        uint32_t dataOffset = static_cast<uint32_t>(text - m_smfFile.data);
+        chunk.pos += event.length;
 
         // In the cases where we dont implement an event type log it, and its data.
         switch(event.type)
         {
             case meta_SequenceNumber:
             {
-                auto sequenceNumber = read_type<uint16_t>(m_smfFile);
-                m_logger->trace(_("Sequence Number {}"), sequenceNumber);
+                if (event.length >= 2)
+                {
+                    auto sequenceNumber = load_be<uint16_t>(payload);
+                    m_logger->trace(_("Sequence Number {}"), sequenceNumber);
+                }
                 break;
             }
             case meta_Text:
@@ -128,72 +446,71 @@ namespace ORCore
             case meta_TextReserved7:
             case meta_TextReserved8:
             {
-                auto textData = std::make_unique<char[]>(event.length+1);
-                textData[event.length] = '\0';
-                read_type<char>(m_smfFile, textData.get(), event.length);
-                m_currentTrack->textEvents.push_back({event, std::string(textData.get())});
+                context.track->textEvents.push_back({event, {dataOffset, event.length}});
                 break;
             }
             case meta_TrackName:
             {
-                auto textData = std::make_unique<char[]>(event.length+1);
-                textData[event.length] = '\0';
-
-                read_type<char>(m_smfFile, textData.get(), event.length);
-                m_currentTrack->name = std::string(textData.get());
+                // Normally already set from the chunk index.
+                if (context.track->name.empty())
+                {
+                    context.track->name = std::string(text, event.length);
+                }
                 break;
             }
             case meta_MIDIChannelPrefix: {
                 // TODO - Add channel 
-                auto midiChannel = read_type<uint8_t>(m_smfFile);
-                m_logger->trace(_("Midi Channel {}"), midiChannel);
+                if (event.length >= 1)
+                {
+                    m_logger->trace(_("Midi Channel {}"), payload[0]);
+                }
                 break;
             }
             case meta_EndOfTrack:
             {
-                m_logger->trace(_("End of Track {} at time"), m_currentTrack->name);
-                m_currentTrack->endTime = event.info.pulseTime;
+                m_logger->trace(_("End of Track {} at time"), context.track->name);
+                context.track->endTime = event.info.pulseTime;
                 break;
             }
             case meta_Tempo:
             {
-                double absTime;
-
-                // We calculate the absTime of each tempo event from the previous which will act as a base to calculate other events time.
-                // This is good because it reduces the number of doubles we store reducing memory usage somewhat, and it also reduces
-                // the rounding error overall allowing more accurate timestamps. Thanks FireFox of the RGC discord for this idea from his
-                // .chart/midi parser that is used for his moonscraper project.
-                if (m_tempoTrack.tempo.size() == 0)
+                if (event.length < 3)
                 {
-                    absTime = 0.0;
-                } else {
-                    auto lastTempo = m_tempoTrack.tempo.back();
-                    absTime = lastTempo.absTime + delta_tick_to_delta_time(&lastTempo, eventInfo.pulseTime - lastTempo.info.info.pulseTime );
+                    m_logger->warn(_("Tempo event too short, ignoring."));
+                    break;
                 }
 
-                uint32_t qnLength = read_type<uint32_t>(m_smfFile, 3);
+                uint32_t qnLength = load_be<uint32_t>(payload, 3);
 
                 double timePerTick = (qnLength / (m_header.division * 1'000'000.0));
 
-                m_tempoTrack.tempoOrdering.push_back({
+                context.tempoOrdering.push_back({
                     TtOrderType::Tempo,
-                    static_cast<int>(m_tempoTrack.tempo.size())
+                    static_cast<int>(context.tempo.size())
                 });
 
-                m_tempoTrack.tempo.push_back({event, qnLength, absTime, timePerTick});
+                // absTime depends on every earlier tempo change, possibly from other
+                // tracks, so it is filled in by merge_tempo_track once all tracks are read.
+                context.tempo.push_back({event, qnLength, 0.0, timePerTick});
 
                 break;
             }
             case meta_TimeSignature:
             {
+                if (event.length < 4)
+                {
+                    m_logger->warn(_("Time signature event too short, ignoring."));
+                    break;
+                }
+
                 TimeSignatureEvent tsEvent;
                 tsEvent.info = event;
-                tsEvent.numerator = read_type<uint8_t>(m_smfFile); // 4 default
-                tsEvent.denominator = std::pow(2, read_type<uint8_t>(m_smfFile)); // 4 default
+                tsEvent.numerator = payload[0]; // 4 default
+                tsEvent.denominator = 1 << std::min<int>(payload[1], 16); // 4 default, stored as a power of 2
 
                 // This is best described as a bad attempt at supporting meter and is basically useless.
                 // The midi spec examples are also extremely misleading
-                tsEvent.clocksPerBeat = read_type<uint8_t>(m_smfFile); // Standard is 24
+                tsEvent.clocksPerBeat = payload[2]; // Standard is 24
 
                 // The number of 1/32nd notes per "MIDI quarter note"
                 // This should be used in order to change the note value which a "MIDI quarter note" is considered.
@@ -208,7 +525,7 @@ namespace ORCore
                 //
                 // Beyond MIDI: The Handbook of Musical Codes page 54 
 
-                tsEvent.thirtySecondPQN = read_type<uint8_t>(m_smfFile); // 8 default
+                tsEvent.thirtySecondPQN = payload[3]; // 8 default
 
                 m_logger->info(_("Time signature  {}/{} CPC: {} TSPQN: {}"),
                                     tsEvent.numerator,
@@ -216,12 +533,12 @@ namespace ORCore
                                     tsEvent.clocksPerBeat,
                                     tsEvent.thirtySecondPQN);
 
-                m_tempoTrack.tempoOrdering.push_back({
+                context.tempoOrdering.push_back({
                         TtOrderType::TimeSignature,
-                        static_cast<int>(m_tempoTrack.timeSignature.size())
+                        static_cast<int>(context.timeSignature.size())
                     });
 
-                m_tempoTrack.timeSignature.push_back(tsEvent);
+                context.timeSignature.push_back(tsEvent);
 
                 break;
             }
@@ -235,24 +552,18 @@ namespace ORCore
             {
                 // store data for unused event for later save passthrough.
                 m_logger->debug(_("Unused event type {}."), event.type);
-                std::vector<char> eventData;
-                for (int i=0;i<event.length;++i)
-                {
-                    eventData.emplace_back(read_type<char>(m_smfFile));
-                }
-                m_currentTrack->miscMeta.push_back({event, eventData});
+                context.track->miscMeta.push_back({event, {dataOffset, event.length}});
                 break;
             }
         }
     }
 
-    void SmfReader::read_sysex_event(SmfEventInfo &event)
+    void SmfReader::read_sysex_event(ChunkReader &chunk, SmfTrackContext &context, SmfEventInfo &event)
     {
-        auto length = read_var_len();
-        std::vector<char> sysex;
-        sysex.resize(length);
-        read_type<char>(m_smfFile, &sysex[0], length);
-        m_logger->info(_("sysex event at position {}"), m_smfFile.get_pos());
+        // Sysex data isn't used so it is skipped over without being copied.
+        auto length = chunk.read_var_len();
+        m_logger->info(_("sysex event at position {}"), chunk.offset());
+        chunk.skip(length);
     }
 
     // Convert from deltaPulses to deltaTime.
@@ -262,17 +573,56 @@ namespace ORCore
     }
 
     // Converts a absolute time in pulses to an absolute time in seconds
-    double SmfReader::pulsetime_to_abstime(uint32_t pulseTime)
+    double SmfReader::pulsetime_to_abstime(uint32_t pulseTime) const
     {
-        if (pulseTime == 0)
+        // The basic idea here is to start from the most recent tempo change before this time.
+        // Then calculate and add the time since that tempo change to the time of the tempo change.
+        const TempoSegment &segment = *find_tempo_segment(pulseTime);
+        return segment.absTime + ((pulseTime - segment.pulseTime) * segment.timePerTick);
+    }
+
+    // Converts count pulse times to seconds. Consecutive times that fall in the same
+    // tempo segment are converted together, so sorted input only costs one lookup per
+    // tempo change and the inner loop is a plain multiply-add the compiler can vectorize.
+    void SmfReader::convert_all(const uint32_t *pulses, double *out, size_t count) const
+    {
+        size_t i = 0;
+        while (i < count)
         {
-            return 0.0;
+            auto segment = find_tempo_segment(pulses[i]);
+            uint32_t segmentStart = segment->pulseTime;
+            uint32_t segmentEnd = (segment + 1 != m_tempoSegments.end()) ? (segment + 1)->pulseTime : UINT32_MAX;
+
+            size_t runEnd = i + 1;
+            while (runEnd < count && pulses[runEnd] >= segmentStart && pulses[runEnd] < segmentEnd)
+            {
+                runEnd++;
+            }
+
+            double absTime = segment->absTime;
+            double timePerTick = segment->timePerTick;
+            for (size_t j = i; j < runEnd; j++)
+            {
+                out[j] = absTime + ((pulses[j] - segmentStart) * timePerTick);
+            }
+            i = runEnd;
         }
-        // The basic idea here is to start from the most recent tempo event before this time.
-        // Then calculate and add the time since that tempo to the tempo time.
-        // To speed this up further we could store the result of the time per tick calculation in the tempo event and only use it here.
-        TempoEvent* tempo = get_last_tempo_via_pulses(pulseTime);
-        return tempo->absTime + ((pulseTime - tempo->info.info.pulseTime) * tempo->timePerTick);
+    }
+
+    std::vector<TempoSegment>::const_iterator SmfReader::find_tempo_segment(uint32_t pulseTime) const
+    {
+        // The first segment always starts at pulse 0 so this never returns begin().
+        auto next = std::upper_bound(m_tempoSegments.begin(), m_tempoSegments.end(), pulseTime,
+            [](uint32_t pulse, const TempoSegment &segment) {
+                return pulse < segment.pulseTime;
+            });
+        return next - 1;
+    }
+
+    // Time per tick of the 120 BPM tempo midi assumes until the first tempo change.
+    double SmfReader::default_time_per_tick()
+    {
+        return smfDefaultQnLength / (m_header.division * 1'000'000.0);
     }
 
     void SmfReader::set_default_tempo_ts()
@@ -281,7 +631,7 @@ namespace ORCore
         {
             m_logger->info(_("Setting default time signature of 4/4."));
 
-            MetaEvent tsEvent {{meta_TimeSignature,0,0}, meta_Tempo, 3};
+            MetaEvent tsEvent {{status_MetaEvent,0,0}, meta_TimeSignature, 4};
 
             m_tempoTrack.tempoOrdering.push_back({
                 TtOrderType::TimeSignature,
@@ -305,83 +655,273 @@ namespace ORCore
                 static_cast<int>(m_tempoTrack.tempo.size())
             });
 
-            m_tempoTrack.tempo.push_back({tempoEvent, 500'000, 0.0}); // ppqn, absTime
+            m_tempoTrack.tempo.push_back({tempoEvent, smfDefaultQnLength, 0.0, default_time_per_tick()});
         }
     }
 
-    TempoEvent* SmfReader::get_last_tempo_via_pulses(uint32_t pulseTime)
+    // Build the table used for pulse to time conversion. It is never modified
+    // afterwards so conversions can safely run from any number of threads.
+    void SmfReader::build_tempo_segments()
     {
-        static unsigned int value = 0;
-        static uint32_t lastPulseTime = 0;
+        auto &tempos = m_tempoTrack.tempo;
 
-        std::vector<TempoEvent> &tempos = m_tempoTrack.tempo;
+        m_tempoSegments.clear();
+        m_tempoSegments.reserve(tempos.size() + 1);
 
-        if (pulseTime > 0)
+        if (tempos.empty() || tempos.front().info.info.pulseTime != 0)
         {
-            set_default_tempo_ts();
+            m_tempoSegments.push_back({0, 0.0, default_time_per_tick()});
         }
 
-        // Ignore the cached last tempo value if the new pulse time is older.
-        if (lastPulseTime > pulseTime) {
-            value = 0;
+        for (auto &tempo : tempos)
+        {
+            // Several tempo changes at the same time, the last one wins.
+            if (!m_tempoSegments.empty() && m_tempoSegments.back().pulseTime == tempo.info.info.pulseTime)
+            {
+                m_tempoSegments.back() = {tempo.info.info.pulseTime, tempo.absTime, tempo.timePerTick};
+            } else {
+                m_tempoSegments.push_back({tempo.info.info.pulseTime, tempo.absTime, tempo.timePerTick});
+            }
         }
+    }
 
-        for (unsigned int i = value; i < tempos.size(); i++) {
-            if (tempos[i].info.info.pulseTime > pulseTime) {
-                value = i-1;
-                lastPulseTime = pulseTime;
-                return &tempos[value];
-            }
+    void SmfReader::read_events(ChunkReader &chunk, SmfTrackContext &context)
+    {
+        if (context.visitor != nullptr)
+        {
+            read_events(chunk, context, *context.visitor);
+        }
+        else if (context.arrays != nullptr)
+        {
+            read_events(chunk, context, *context.arrays);
+        } else {
+            read_events(chunk, context, context.track->midiEvents);
         }
-        // return last value if nothing else is found
-        return &tempos.back();  
     }
 
-    void SmfReader::read_events(uint32_t chunkEnd)
+    template<typename Storage>
+    void SmfReader::read_events(ChunkReader &chunk, SmfTrackContext &context, Storage &midiEvents)
     {
         uint32_t pulseTime = 0;
         uint8_t prevStatus = 0;
 
-        // find a ballpark size estimate for the track 
-        uint32_t sizeGuess = (chunkEnd - m_smfFile.get_pos()) / 3;
-        m_currentTrack->midiEvents.reserve(sizeGuess);
+        reserve_midi_events(midiEvents, chunk);
 
-        while (m_smfFile.get_pos() < chunkEnd)
+        while (chunk.remaining() > 0)
         {
-            SmfEventInfo eventInfo;
+            // Hot loop for channel events, which are nearly everything in a track.
+            // While at least smfMaxEventHeader bytes remain a whole channel event is
+            // known to fit, so nothing in here is bounds checked and the cursor
+            // stays in a register. Anything else drops to the checked path below.
+            const uint8_t *pos = chunk.pos;
+            const uint8_t *fastEnd = chunk.end - std::min(chunk.remaining(), smfMaxEventHeader);
+
+            while (pos < fastEnd)
+            {
+                const uint8_t *eventStart = pos;
+                uint32_t deltaPulses = decode_var_len(pos);
+                uint8_t status = *pos;
+
+                if (status >= 0xF0) {
+                    pos = eventStart;
+                    break;
+                } else if (status & 0x80) {
+                    ++pos;
+                } else if (prevStatus != 0) {
+                    status = prevStatus; // running status
+                } else {
+                    pos = eventStart;
+                    break;
+                }
 
-            eventInfo.deltaPulses = read_var_len();
+                // DO NOT use this for time calculations.
+                // You must convert each deltaPulse to a time
+                // within the currently active tempo.
+                pulseTime += deltaPulses;
 
-            // DO NOT use this for time calculations.
-            // You must convert each deltaPulse to a time
-            // within the currently active tempo.
-            pulseTime += eventInfo.deltaPulses;
+                uint8_t length = channelDataLength[(status >> 4) & 0x7];
+
+                push_midi_event(midiEvents, status, pulseTime, pos[0], length > 1 ? pos[1] : 0);
+                pos += length;
+                prevStatus = status;
+            }
+            chunk.pos = pos;
+
+            if (chunk.remaining() == 0)
+            {
+                break;
+            }
 
+            // Checked path for meta/sysex events and the tail of the chunk.
+            SmfEventInfo eventInfo;
+            eventInfo.deltaPulses = chunk.read_var_len();
+            pulseTime += eventInfo.deltaPulses;
             eventInfo.pulseTime = pulseTime;
-            auto status = peek_type<uint8_t>(m_smfFile);
+
+            auto status = chunk.peek_u8();
 
             if (status == status_MetaEvent) {
                 prevStatus = 0; // reset running status
-                eventInfo.status = read_type<uint8_t>(m_smfFile);
-                read_meta_event(eventInfo);
+                eventInfo.status = chunk.read_u8();
+                read_meta_event(chunk, context, eventInfo);
             } else if (status == status_SysexEvent || status == status_SysexEvent2) {
                 prevStatus = 0;  // reset running status
-                eventInfo.status = read_type<uint8_t>(m_smfFile);
-                read_sysex_event(eventInfo);
+                eventInfo.status = chunk.read_u8();
+                read_sysex_event(chunk, context, eventInfo);
             } else {
                 // Check if we should use the running status.
                 if ((status & 0xF0) >= 0x80) {
-                    eventInfo.status = read_type<uint8_t>(m_smfFile);
+                    eventInfo.status = chunk.read_u8();
                 } else {
                     eventInfo.status = prevStatus;
                 }
-                read_midi_event(eventInfo);
+                uint8_t data1, data2;
+                if (read_midi_event(chunk, eventInfo, data1, data2))
+                {
+                    push_midi_event(midiEvents, eventInfo.status, eventInfo.pulseTime, data1, data2);
+                }
                 prevStatus = eventInfo.status;
             }
         }
     }
 
-    void SmfReader::read_file()
+    void SmfReader::parse()
+    {
+        m_logger->info(_("Parsing midi."));
+
+        read_file();
+    }
+
+    void SmfReader::read_track(SmfTrackChunk &trackChunk, SmfTrackContext &context)
+    {
+        ChunkReader chunkReader(m_smfFile, trackChunk.offset, trackChunk.length);
+        try {
+            read_events(chunkReader, context);
+        } catch (std::runtime_error &err) {
+            m_logger->warn(_("Track chunk is malformed, ignoring the rest of the track: {}"), err.what());
+        }
+    }
+
+    // Read the track name from the meta events at the start of a track without decoding the rest.
+    void SmfReader::read_track_name(SmfTrackChunk &trackChunk)
+    {
+        ChunkReader chunk(m_smfFile, trackChunk.offset, trackChunk.length);
+        try {
+            while (chunk.remaining() > 0)
+            {
+                chunk.read_var_len();
+                if (chunk.read_u8() != status_MetaEvent)
+                {
+                    break;
+                }
+
+                auto type = chunk.read_u8();
+                auto length = chunk.read_var_len();
+                chunk.require(length);
+
+                if (type == meta_TrackName)
+                {
+                    trackChunk.name = std::string(reinterpret_cast<const char*>(chunk.pos), length);
+                    break;
+                }
+                chunk.skip(length);
+            }
+        } catch (std::runtime_error &err) {
+            // A malformed track is reported when it is decoded.
+        }
+    }
+
+    void SmfReader::decode_tracks(std::vector<size_t> &indices)
+    {
+        parallel_for(indices.size(), [&](size_t i)
+        {
+            size_t index = indices[i];
+
+            SmfTrackContext context;
+            context.track = &m_tracks[index];
+            read_track(m_trackChunks[index], context);
+            check_tempo_changes(context);
+            m_trackChunks[index].decoded = true;
+        });
+    }
+
+    void SmfReader::check_tempo_changes(SmfTrackContext &context)
+    {
+        // The tempo map is built from the first track when the file is opened and
+        // may already be in use, so later changes can't be merged into it.
+        if (!context.tempo.empty() || !context.timeSignature.empty())
+        {
+            m_logger->warn(_("Ignoring tempo map changes in track {}, they are only read from the first track."), context.track->name);
+        }
+    }
+
+    // Combine the tempo and time signature changes found in each track into m_tempoTrack,
+    // ordered by time, and calculate the absolute time of each tempo change.
+    void SmfReader::merge_tempo_track(std::vector<SmfTrackContext> &contexts)
+    {
+        struct OrderedEvent
+        {
+            uint32_t pulseTime;
+            TtOrderType type;
+            void *event;
+        };
+
+        // Contexts are in track order and each context is in file order, so a
+        // stable sort keeps the file ordering for changes at the same time.
+        std::vector<OrderedEvent> ordered;
+        for (auto &context : contexts)
+        {
+            for (auto &order : context.tempoOrdering)
+            {
+                if (order.type == TtOrderType::Tempo)
+                {
+                    auto &tempo = context.tempo[order.index];
+                    ordered.push_back({tempo.info.info.pulseTime, order.type, &tempo});
+                } else {
+                    auto &ts = context.timeSignature[order.index];
+                    ordered.push_back({ts.info.info.pulseTime, order.type, &ts});
+                }
+            }
+        }
+        std::stable_sort(ordered.begin(), ordered.end(), [](const OrderedEvent &a, const OrderedEvent &b) {
+            return a.pulseTime < b.pulseTime;
+        });
+
+        for (auto &order : ordered)
+        {
+            if (order.type == TtOrderType::Tempo)
+            {
+                TempoEvent tempo = *static_cast<TempoEvent*>(order.event);
+
+                // We calculate the absTime of each tempo event from the previous which will act as a base to calculate other events time.
+                // This is good because it reduces the number of doubles we store reducing memory usage somewhat, and it also reduces
+                // the rounding error overall allowing more accurate timestamps. Thanks FireFox of the RGC discord for this idea from his
+                // .chart/midi parser that is used for his moonscraper project.
+                if (m_tempoTrack.tempo.size() == 0)
+                {
+                    tempo.absTime = tempo.info.info.pulseTime * default_time_per_tick();
+                } else {
+                    auto &lastTempo = m_tempoTrack.tempo.back();
+                    tempo.absTime = lastTempo.absTime + delta_tick_to_delta_time(&lastTempo, tempo.info.info.pulseTime - lastTempo.info.info.pulseTime);
+                }
+
+                m_tempoTrack.tempoOrdering.push_back({
+                    TtOrderType::Tempo,
+                    static_cast<int>(m_tempoTrack.tempo.size())
+                });
+                m_tempoTrack.tempo.push_back(tempo);
+            } else {
+                m_tempoTrack.tempoOrdering.push_back({
+                    TtOrderType::TimeSignature,
+                    static_cast<int>(m_tempoTrack.timeSignature.size())
+                });
+                m_tempoTrack.timeSignature.push_back(*static_cast<TimeSignatureEvent*>(order.event));
+            }
+        }
+    }
+
+    // First pass over the file, reads the header and builds the table of track chunks.
+    void SmfReader::scan_chunks()
     {
         uint32_t fileEnd = m_smfFile.get_size();
 
@@ -394,11 +934,6 @@ namespace ORCore
         // set the intial chunk starting position at the beginning of the file.
         uint32_t chunkStart = fileStart;
 
-        // The chunk end will be calculated after a chunk is loaded.
-        uint32_t chunkEnd = 0;
-
-        int trackChunkCount = 0;
-
         // We could loop through the number of track chunks given in the header.
         // However if there are any unknown chunk types inside the midi file
         // this will likely break. So we just loop until we hit the end of the
@@ -408,7 +943,14 @@ namespace ORCore
 
             read_type<char>(m_smfFile, chunk.chunkType, 4);
             chunk.length = read_type<uint32_t>(m_smfFile);
-            chunkEnd = chunkStart + (8 + chunk.length); // 8 is the length of the type + length fields
+
+            uint32_t dataStart = m_smfFile.get_pos();
+            uint32_t dataLength = chunk.length;
+            if (dataLength > fileEnd - dataStart)
+            {
+                m_logger->warn(_("Chunk of type {} extends past the end of the file, truncating."), chunk.chunkType);
+                dataLength = fileEnd - dataStart;
+            }
 
             m_logger->trace(_("chunk of type {} detected."), chunk.chunkType);
             // MThd chunk is only in the beginning of the file.
@@ -420,8 +962,8 @@ namespace ORCore
                 m_header.trackNum = read_type<uint16_t>(m_smfFile);
                 m_header.division = read_type<int16_t>(m_smfFile);
 
-                // Make sure we reserve enough space for m_tracks just in-case.
-                m_tracks.reserve(sizeof(SmfTrack) * m_header.trackNum);
+                // Every chunk has an 8 byte header, so a bogus track count can't reserve more than the file could hold.
+                m_trackChunks.reserve(std::min<size_t>(m_header.trackNum, fileEnd / 8));
 
                 if (m_header.format == smfType0 && m_header.trackNum != 1)
                 {
@@ -436,31 +978,24 @@ namespace ORCore
                 {
                     throw std::runtime_error(_("SMPTE time division not supported"));
                 }
+                else if (m_header.division == 0)
+                {
+                    throw std::runtime_error(_("Invalid time division."));
+                }
             }
             else if (strcmp(chunk.chunkType, "MTrk") == 0)
             {
-                trackChunkCount += 1;
-                m_tracks.emplace_back();
-                m_currentTrack = &m_tracks.back();
-                read_events(chunkEnd);
-
+                m_trackChunks.push_back({dataStart, dataLength, "", false});
             }
             else
             {
                 m_logger->warn(_("Non-standard chunk of type {} detected, skipping."), chunk.chunkType);
             }
 
-            filePos = chunkEnd;
+            filePos = dataStart + dataLength;
             chunkStart = filePos;
+            m_smfFile.set_pos(filePos);
 
-            // Make sure that we are in the correct location in the chunk
-            // If not seek to the correct location and output an error in the log.
-            if (static_cast<int>(m_smfFile.get_pos()) != filePos)
-            {
-                m_logger->warn(_("Offset for chunk '{}' incorrect, seeking to correct location."), chunk.chunkType);
-                m_logger->warn(_("Offset difference. expected: '{}' actual: '{}'"), m_smfFile.get_pos(), filePos);
-                m_smfFile.set_pos(filePos);
-            }
             fileRemaining = (fileEnd-filePos);
             if (fileRemaining != 0 && fileRemaining <= 8)
             {
@@ -470,11 +1005,260 @@ namespace ORCore
             }
         }
 
-        if (trackChunkCount != m_header.trackNum)
+        if (m_trackChunks.size() != m_header.trackNum)
         {
             m_logger->warn(_("Track chunk count does not match header."));
         }
-        m_logger->info(_("End of MIDI reached."));
+    }
+
+    // Only the chunk index and the first track are read up front. The first track
+    // holds the tempo map (it is the only track of a type 0 midi), everything else
+    // is decoded on demand, in parallel, by get_tracks and get_track.
+    void SmfReader::read_file()
+    {
+        scan_chunks();
 
+        m_tracks.resize(m_trackChunks.size());
+        for (size_t i = 0; i < m_trackChunks.size(); i++)
+        {
+            read_track_name(m_trackChunks[i]);
+            m_tracks[i].name = m_trackChunks[i].name;
+        }
+
+        std::vector<SmfTrackContext> contexts;
+        if (!m_trackChunks.empty())
+        {
+            contexts.emplace_back();
+            contexts[0].track = &m_tracks[0];
+            read_track(m_trackChunks[0], contexts[0]);
+            m_trackChunks[0].decoded = true;
+        }
+
+        merge_tempo_track(contexts);
+        set_default_tempo_ts();
+        build_tempo_segments();
+
+        m_logger->info(_("Indexed {} tracks."), m_trackChunks.size());
+    }
+
+    /////////////////////////////////////
+    // SmfWriter
+    /////////////////////////////////////
+
+    template<typename T>
+    static void append_be(std::vector<uint8_t> &out, T value)
+    {
+        out.resize(out.size() + sizeof(T));
+        store_be(&out[out.size() - sizeof(T)], value);
+    }
+
+    static void append_var_len(std::vector<uint8_t> &out, uint32_t value)
+    {
+        if (value > 0x0FFFFFFF)
+        {
+            throw std::runtime_error(_("Value too large for a variable length quantity."));
+        }
+
+        uint8_t bytes[4];
+        int count = 0;
+        do {
+            bytes[count++] = value & 0x7F;
+            value >>= 7;
+        } while (value != 0);
+
+        // Most significant group first, every byte but the last has the continuation bit set.
+        while (count > 1)
+        {
+            out.push_back(bytes[--count] | 0x80);
+        }
+        out.push_back(bytes[0]);
+    }
+
+    SmfWriter::SmfWriter(SmfType format, uint16_t division)
+    : m_format(format),
+    m_division(division),
+    m_runningStatus(false)
+    {
+        if (format == smfType2)
+        {
+            throw std::runtime_error(_("Type 2 midi not supported."));
+        }
+        if (division == 0 || (division & 0x8000) != 0)
+        {
+            throw std::runtime_error(_("Invalid time division."));
+        }
+    }
+
+    void SmfWriter::set_running_status(bool enabled)
+    {
+        m_runningStatus = enabled;
+    }
+
+    size_t SmfWriter::add_track(std::string name)
+    {
+        if (m_format == smfType0 && m_tracks.size() == 1)
+        {
+            throw std::runtime_error(_("Not a valid type 0 midi."));
+        }
+        m_tracks.push_back({name, {}, {}});
+        return m_tracks.size() - 1;
+    }
+
+    void SmfWriter::add_tempo(size_t track, uint32_t pulseTime, uint32_t qnLength)
+    {
+        std::string data {
+            static_cast<char>((qnLength >> 16) & 0xFF),
+            static_cast<char>((qnLength >> 8) & 0xFF),
+            static_cast<char>(qnLength & 0xFF)
+        };
+        add_meta_event(track, pulseTime, meta_Tempo, data);
+    }
+
+    void SmfWriter::add_time_signature(size_t track, uint32_t pulseTime, uint8_t numerator, uint8_t denominator, uint8_t clocksPerBeat, uint8_t thirtySecondPQN)
+    {
+        // The denominator is stored as a power of 2.
+        uint8_t denominatorPower = 0;
+        while ((1 << (denominatorPower + 1)) <= denominator)
+        {
+            denominatorPower++;
+        }
+
+        std::string data {
+            static_cast<char>(numerator),
+            static_cast<char>(denominatorPower),
+            static_cast<char>(clocksPerBeat),
+            static_cast<char>(thirtySecondPQN)
+        };
+        add_meta_event(track, pulseTime, meta_TimeSignature, data);
+    }
+
+    void SmfWriter::add_meta_event(size_t track, uint32_t pulseTime, MidiMetaEvent type, std::string data)
+    {
+        get_track(track).metaEvents.push_back({pulseTime, type, std::move(data)});
+    }
+
+    void SmfWriter::add_midi_event(size_t track, uint32_t pulseTime, MidiChannelMessage message, uint8_t channel, uint8_t data1, uint8_t data2)
+    {
+        uint8_t status = static_cast<uint8_t>(message) | (channel & 0xF);
+        get_track(track).events.push_back({pulseTime, status, static_cast<uint8_t>(data1 & 0x7F), static_cast<uint8_t>(data2 & 0x7F)});
+    }
+
+    void SmfWriter::add_note(size_t track, uint32_t pulseTime, uint32_t length, uint8_t channel, uint8_t note, uint8_t velocity)
+    {
+        add_midi_event(track, pulseTime, NoteOn, channel, note, velocity);
+        add_midi_event(track, pulseTime + length, NoteOff, channel, note, 0);
+    }
+
+    void SmfWriter::reserve(size_t track, size_t eventCount)
+    {
+        get_track(track).events.reserve(eventCount);
+    }
+
+    std::vector<uint8_t> SmfWriter::get_data()
+    {
+        std::vector<uint8_t> out;
+
+        out.insert(out.end(), {'M', 'T', 'h', 'd'});
+        append_be<uint32_t>(out, 6);
+        append_be<uint16_t>(out, m_format);
+        append_be<uint16_t>(out, static_cast<uint16_t>(m_tracks.size()));
+        append_be<uint16_t>(out, m_division);
+
+        for (auto &track : m_tracks)
+        {
+            write_track(out, track);
+        }
+        return out;
+    }
+
+    void SmfWriter::write(std::string filename)
+    {
+        std::vector<uint8_t> data = get_data();
+
+        std::ofstream file(filename, std::ios_base::binary | std::ios_base::trunc);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        if (!file)
+        {
+            throw std::runtime_error(_("Failed to write MIDI file."));
+        }
+    }
+
+    SmfWriterTrack &SmfWriter::get_track(size_t track)
+    {
+        if (track >= m_tracks.size())
+        {
+            throw std::out_of_range(_("Invalid track index."));
+        }
+        return m_tracks[track];
+    }
+
+    void SmfWriter::write_track(std::vector<uint8_t> &out, SmfWriterTrack &track)
+    {
+        auto byTime = [](const auto &a, const auto &b) {
+            return a.pulseTime < b.pulseTime;
+        };
+        std::stable_sort(track.events.begin(), track.events.end(), byTime);
+        std::stable_sort(track.metaEvents.begin(), track.metaEvents.end(), byTime);
+
+        out.insert(out.end(), {'M', 'T', 'r', 'k'});
+        size_t lengthPos = out.size();
+        append_be<uint32_t>(out, 0); // Filled in once the track is written.
+        size_t dataStart = out.size();
+
+        // A channel event is at most 4 bytes of delta and 3 of message.
+        out.reserve(out.size() + track.events.size() * smfMaxEventHeader);
+
+        uint32_t lastPulseTime = 0;
+        uint8_t prevStatus = 0;
+
+        auto write_meta = [&](uint32_t pulseTime, MidiMetaEvent type, const std::string &data)
+        {
+            append_var_len(out, pulseTime - lastPulseTime);
+            out.push_back(status_MetaEvent);
+            out.push_back(type);
+            append_var_len(out, static_cast<uint32_t>(data.size()));
+            out.insert(out.end(), data.begin(), data.end());
+            lastPulseTime = pulseTime;
+            prevStatus = 0; // running status doesn't carry across meta events
+        };
+
+        // The track name goes first so readers can find it without decoding the track.
+        write_meta(0, meta_TrackName, track.name);
+
+        auto meta = track.metaEvents.begin();
+        for (auto &event : track.events)
+        {
+            while (meta != track.metaEvents.end() && meta->pulseTime <= event.pulseTime)
+            {
+                write_meta(meta->pulseTime, meta->type, meta->data);
+                ++meta;
+            }
+
+            append_var_len(out, event.pulseTime - lastPulseTime);
+            if (!m_runningStatus || event.status != prevStatus)
+            {
+                out.push_back(event.status);
+            }
+            out.push_back(event.data1);
+            if (channelDataLength[(event.status >> 4) & 0x7] > 1)
+            {
+                out.push_back(event.data2);
+            }
+            lastPulseTime = event.pulseTime;
+            prevStatus = event.status;
+        }
+        for (; meta != track.metaEvents.end(); ++meta)
+        {
+            write_meta(meta->pulseTime, meta->type, meta->data);
+        }
+
+        write_meta(lastPulseTime, meta_EndOfTrack, "");
+
+        size_t length = out.size() - dataStart;
+        if (length > UINT32_MAX)
+        {
+            throw std::runtime_error(_("Track too large for a MIDI file."));
+        }
+        store_be(&out[lengthPos], static_cast<uint32_t>(length));
     }
 } // namespace ORCore
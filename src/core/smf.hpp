@@ -3,6 +3,7 @@
 #include <stdexcept>
 #include <string>
 #include <memory>
+#include <functional>
 #include <spdlog/spdlog.h>
 
 #include "parseutils.hpp"
@@ -69,6 +70,9 @@ namespace ORCore
         smfType2,
     };
 
+    // Quarter note length in microseconds used until the first tempo change, 120 BPM.
+    const uint32_t smfDefaultQnLength = 500'000;
+
     struct SmfChunkInfo
     {
         char chunkType[5];
@@ -106,12 +110,20 @@ namespace ORCore
         uint32_t length;
     };
 
+    // Location of an event's payload within the midi file. Payloads are left in the
+    // reader's buffer and only copied out by SmfReader::get_text/get_data.
+    struct SmfDataView
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
     // This is for storing currently unused meta events for
-    // passthrough once we have a midi writer.
+    // passthrough to SmfWriter.
     struct MetaStorageEvent
     {
         MetaEvent event;
-        std::vector<char> data;
+        SmfDataView data;
     };
 
     struct SysexEvent
@@ -121,19 +133,35 @@ namespace ORCore
         uint32_t length;
     };
 
+    // Channel events are by far the most common so they are packed into 8 bytes.
+    // The delta time isn't stored, it is the difference from the previous event.
     struct MidiEvent
     {
-        SmfEventInfo info;
-        MidiChannelMessage message;
-        uint8_t channel;
+        uint32_t pulseTime;
+        uint8_t status;
         uint8_t data1;
         uint8_t data2;
+
+        MidiChannelMessage message() const;
+        uint8_t channel() const;
     };
 
+    static_assert(sizeof(MidiEvent) == 8, "MidiEvent should stay packed into 8 bytes.");
+
+    inline MidiChannelMessage MidiEvent::message() const
+    {
+        return static_cast<MidiChannelMessage>(status & 0xF0);
+    }
+
+    inline uint8_t MidiEvent::channel() const
+    {
+        return status & 0xF;
+    }
+
     struct TextEvent
     {
         MetaEvent info;
-        std::string text;
+        SmfDataView text;
     };
 
     struct TempoEvent
@@ -172,6 +200,26 @@ namespace ORCore
 
     };
 
+    // Structure of arrays form of a track's channel events. Keeping each field in
+    // its own array lets filters over status and data1 check 16 events at a time.
+    struct SmfEventArrays
+    {
+        std::vector<uint32_t> pulseTime;
+        std::vector<uint8_t> status;
+        std::vector<uint8_t> data1;
+        std::vector<uint8_t> data2;
+
+        size_t size() const;
+    };
+
+    inline size_t SmfEventArrays::size() const
+    {
+        return status.size();
+    }
+
+    // Appends the index of every NoteOn/NoteOff event with data1 in [low, high] to indices.
+    void find_note_events(const SmfEventArrays &events, uint8_t low, uint8_t high, std::vector<uint32_t> &indices);
+
     struct SmfTrack
     { 
         std::string name;
@@ -181,6 +229,14 @@ namespace ORCore
         std::vector<MetaStorageEvent> miscMeta;
     };
 
+    // A span of the midi with a constant tempo, starting at pulseTime.
+    struct TempoSegment
+    {
+        uint32_t pulseTime;
+        double absTime;
+        double timePerTick;
+    };
+
     struct TempoTrack
     {
         std::vector<TempoEvent> tempo;
@@ -188,33 +244,185 @@ namespace ORCore
         std::vector<TteventIndex> tempoOrdering;
     };
 
+    // Index entry for a MTrk chunk, the name is read when the file is opened
+    // so tracks can be found without decoding their events.
+    struct SmfTrackChunk
+    {
+        uint32_t offset;
+        uint32_t length;
+        std::string name;
+        bool decoded;
+    };
+
+    // A channel event as handed to SmfReader::visit_track, with its time in seconds.
+    struct SmfVisitEvent
+    {
+        uint32_t pulseTime;
+        double time;
+        uint8_t status;
+        uint8_t data1;
+        uint8_t data2;
+
+        MidiChannelMessage message() const;
+        uint8_t channel() const;
+    };
+
+    inline MidiChannelMessage SmfVisitEvent::message() const
+    {
+        return static_cast<MidiChannelMessage>(status & 0xF0);
+    }
+
+    inline uint8_t SmfVisitEvent::channel() const
+    {
+        return status & 0xF;
+    }
+
+    using SmfVisitor = std::function<void(const SmfVisitEvent&)>;
+
+    // Passes decoded events straight on to a visitor. Events within a track are in
+    // time order so the current tempo segment only ever moves forward.
+    struct SmfEventVisitor
+    {
+        const SmfVisitor &visitor;
+        const std::vector<TempoSegment> &tempoSegments;
+        size_t segment;
+    };
+
+    // Decoding state for a single track. Tempo and time signature changes are
+    // collected per track and merged afterwards so tracks can be read in parallel.
+    struct SmfTrackContext
+    {
+        SmfTrack *track;
+        std::vector<TempoEvent> tempo;
+        std::vector<TimeSignatureEvent> timeSignature;
+        std::vector<TteventIndex> tempoOrdering;
+
+        // When set, channel events go to the visitor or the arrays instead of being stored in the track.
+        SmfEventVisitor *visitor = nullptr;
+        SmfEventArrays *arrays = nullptr;
+    };
+
     class SmfReader
     {
     public:
-        SmfReader(std::string smfData);
+        SmfReader(std::string filename);
+
+        // Parse a midi already in memory, the caller must keep smfData alive as long as the reader.
+        SmfReader(const char *smfData, uint32_t size);
+
+        // Tracks other than the first are only decoded once they are requested.
+        // These are not thread safe, request tracks from one thread at a time.
         std::vector<SmfTrack*> get_tracks();
+        SmfTrack* get_track(std::string name);
+        std::vector<std::string> get_track_names();
+
+        // Event payloads are read from the midi file, which the reader keeps until release.
+        std::string get_text(SmfDataView view);
+        const char* get_data(SmfDataView view);
+
+        // Decode a track, handing each channel event to visitor as it is read rather than
+        // storing it. The returned track has everything but the channel events. This
+        // doesn't change the reader, so tracks can be visited from several threads at once.
+        SmfTrack visit_track(size_t index, const SmfVisitor &visitor);
+        SmfTrack visit_track(std::string name, const SmfVisitor &visitor);
+
+        // Decode a track's channel events into arrays, for scanning with find_note_events.
+        // Like visit_track the returned track has everything else, and the reader is unchanged.
+        SmfTrack read_event_arrays(size_t index, SmfEventArrays &arrays);
+        SmfTrack read_event_arrays(std::string name, SmfEventArrays &arrays);
         TempoTrack* get_tempo_track();
-        double pulsetime_to_abstime(uint32_t pulseTime);
+        double pulsetime_to_abstime(uint32_t pulseTime) const;
+        void convert_all(const uint32_t *pulses, double *out, size_t count) const;
         void release();
 
+        // Approximate heap and mapped memory held by the reader, including the midi file itself.
+        size_t retained_bytes();
+
     private:
         FileBuffer m_smfFile;
         SmfHeaderChunk m_header;
         TempoTrack m_tempoTrack;
+        std::vector<TempoSegment> m_tempoSegments;
         std::vector<SmfTrack> m_tracks;
+        std::vector<SmfTrackChunk> m_trackChunks;
 
-        SmfTrack *m_currentTrack;
-
-        uint32_t read_var_len();
-        void read_midi_event(SmfEventInfo &event);
-        void read_meta_event(SmfEventInfo &event);
-        void read_sysex_event(SmfEventInfo &event);
+        bool read_midi_event(ChunkReader &chunk, SmfEventInfo &event, uint8_t &data1, uint8_t &data2);
+        void read_meta_event(ChunkReader &chunk, SmfTrackContext &context, SmfEventInfo &event);
+        void read_sysex_event(ChunkReader &chunk, SmfTrackContext &context, SmfEventInfo &event);
         double delta_tick_to_delta_time(TempoEvent* tempo, uint32_t deltaPulses);
+        double default_time_per_tick();
         void set_default_tempo_ts();
-        TempoEvent* get_last_tempo_via_pulses(uint32_t pulseTime);
-        void read_events(uint32_t chunkEnd);
+        void build_tempo_segments();
+        std::vector<TempoSegment>::const_iterator find_tempo_segment(uint32_t pulseTime) const;
+        void read_events(ChunkReader &chunk, SmfTrackContext &context);
+        template<typename Storage>
+        void read_events(ChunkReader &chunk, SmfTrackContext &context, Storage &midiEvents);
+        void read_track(SmfTrackChunk &trackChunk, SmfTrackContext &context);
+        SmfTrack read_detached_track(size_t index, SmfTrackContext &context);
+        size_t find_track_index(std::string name);
+        void check_tempo_changes(SmfTrackContext &context);
+        void read_track_name(SmfTrackChunk &trackChunk);
+        void decode_tracks(std::vector<size_t> &indices);
+        void merge_tempo_track(std::vector<SmfTrackContext> &contexts);
+        void scan_chunks();
         void read_file();
+        void parse();
 
         std::shared_ptr<spdlog::logger> m_logger;
     };
+
+    // Channel event queued for writing, 8 bytes so very large charts stay cheap to build.
+    struct SmfWriterEvent
+    {
+        uint32_t pulseTime;
+        uint8_t status;
+        uint8_t data1;
+        uint8_t data2;
+    };
+
+    struct SmfWriterMetaEvent
+    {
+        uint32_t pulseTime;
+        MidiMetaEvent type;
+        std::string data;
+    };
+
+    struct SmfWriterTrack
+    {
+        std::string name;
+        std::vector<SmfWriterEvent> events;
+        std::vector<SmfWriterMetaEvent> metaEvents;
+    };
+
+    // Builds a midi file in memory. Events can be added to a track in any order,
+    // they are sorted by time when the file is written. Events at the same time
+    // keep the order they were added in, with meta events ahead of channel events.
+    class SmfWriter
+    {
+    public:
+        SmfWriter(SmfType format, uint16_t division);
+
+        // Omit the status byte of channel events that repeat the previous status.
+        void set_running_status(bool enabled);
+
+        size_t add_track(std::string name);
+        void add_tempo(size_t track, uint32_t pulseTime, uint32_t qnLength);
+        void add_time_signature(size_t track, uint32_t pulseTime, uint8_t numerator, uint8_t denominator, uint8_t clocksPerBeat = 24, uint8_t thirtySecondPQN = 8);
+        void add_meta_event(size_t track, uint32_t pulseTime, MidiMetaEvent type, std::string data);
+        void add_midi_event(size_t track, uint32_t pulseTime, MidiChannelMessage message, uint8_t channel, uint8_t data1, uint8_t data2 = 0);
+        void add_note(size_t track, uint32_t pulseTime, uint32_t length, uint8_t channel, uint8_t note, uint8_t velocity);
+        void reserve(size_t track, size_t eventCount);
+
+        std::vector<uint8_t> get_data();
+        void write(std::string filename);
+
+    private:
+        SmfType m_format;
+        uint16_t m_division;
+        bool m_runningStatus;
+        std::vector<SmfWriterTrack> m_tracks;
+
+        SmfWriterTrack &get_track(size_t track);
+        void write_track(std::vector<uint8_t> &out, SmfWriterTrack &track);
+    };
 } // namespace ORCore
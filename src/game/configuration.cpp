@@ -41,6 +41,28 @@ ORCore::Parameter<int>  audio_latency_ms(10,
 ORCore::Parameter<bool>  audio_stereo(true,
     _(" "), _(" "), "", "");
 
+// Volumes are percentages
+ORCore::Parameter<int>  volume_track(100,
+    _("Track Volume"), _(" "), "", "");
+ORCore::Parameter<int>  volume_background(80,
+    _("Background Volume"), _(" "), "", "");
+ORCore::Parameter<int>  volume_screw_up(40,
+    _("Screw-up Volume"), _(" "), "", "");
+ORCore::Parameter<int>  volume_miss(20,
+    _("Miss Volume"), _(" "), "", "");
+ORCore::Parameter<int>  volume_crowd(80,
+    _("Crowd Volume"), _(" "), "", "");
+ORCore::Parameter<int>  volume_kill(0,
+    _("Kill Volume"), _(" "), "", "");
+ORCore::Parameter<int>  volume_effects(70,
+    _("Effects Volume"), _(" "), "", "");
+ORCore::Parameter<int>  volume_menu(60,
+    _("Menu Volume"), _(" "), "", "");
+
+
+ORCore::Parameter<int>  game_hit_window_ms(70,
+    _("Hit Window"), _("How far from a note in milliseconds it can still be hit"), "", "");
+
 
 ORCore::Parameter<std::string>  debug_song1("",
     _(" "), _(" "), "", "");
@@ -80,6 +102,19 @@ void readConfigurationFile(std::string path) {
     YAML::Node window = config["window"];
     setParam(window_fps_max, window["fps_max"]);
 
+    YAML::Node volumes = config["audio"]["volumes"];
+    setParam(volume_track, volumes["track"]);
+    setParam(volume_background, volumes["background"]);
+    setParam(volume_screw_up, volumes["screw-up"]);
+    setParam(volume_miss, volumes["miss"]);
+    setParam(volume_crowd, volumes["crowd"]);
+    setParam(volume_kill, volumes["kill"]);
+    setParam(volume_effects, volumes["effects"]);
+    setParam(volume_menu, volumes["menu"]);
+
+    YAML::Node game = config["game"];
+    setParam(game_hit_window_ms, game["hit_window"]);
+
     YAML::Node debug_songs = config["debug"]["test_songs"];
     if (debug_songs.IsSequence()){
          if(debug_songs.size()>=1)
@@ -141,14 +176,14 @@ void writeConfigurationFile() {
             << YAML::EndMap
         << YAML::Key << "volumes"
             << YAML::BeginMap
-            << YAML::Key << "track"     << YAML::Value << 100
-            << YAML::Key << "background"<< YAML::Value << 80
-            << YAML::Key << "screw-up"  << YAML::Value << 40
-            << YAML::Key << "miss"      << YAML::Value << 20
-            << YAML::Key << "crowd"     << YAML::Value << 80
-            << YAML::Key << "kill"      << YAML::Value << 00
-            << YAML::Key << "effects"   << YAML::Value << 70
-            << YAML::Key << "menu"      << YAML::Value << 60
+            << YAML::Key << "track"     << YAML::Value << volume_track
+            << YAML::Key << "background"<< YAML::Value << volume_background
+            << YAML::Key << "screw-up"  << YAML::Value << volume_screw_up
+            << YAML::Key << "miss"      << YAML::Value << volume_miss
+            << YAML::Key << "crowd"     << YAML::Value << volume_crowd
+            << YAML::Key << "kill"      << YAML::Value << volume_kill
+            << YAML::Key << "effects"   << YAML::Value << volume_effects
+            << YAML::Key << "menu"      << YAML::Value << volume_menu
             << YAML::EndMap
         << YAML::EndMap
 
@@ -165,7 +200,7 @@ void writeConfigurationFile() {
         << YAML::Key << "mute_end_secs" << YAML::Value << 0
         << YAML::Key << "default_speed" << YAML::Value << 1
         << YAML::Key << "whammy_effect" << YAML::Value << false
-        << YAML::Key << "hit_window"    << YAML::Value << 0
+        << YAML::Key << "hit_window"    << YAML::Value << game_hit_window_ms
         << YAML::EndMap
 
     << YAML::Key << "debug"
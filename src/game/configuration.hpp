@@ -19,6 +19,19 @@ extern ORCore::Parameter<std::string>           window_fps;
 extern ORCore::Parameter<int>                   window_fps_max;
 
 
+extern ORCore::Parameter<int> volume_track;
+extern ORCore::Parameter<int> volume_background;
+extern ORCore::Parameter<int> volume_screw_up;
+extern ORCore::Parameter<int> volume_miss;
+extern ORCore::Parameter<int> volume_crowd;
+extern ORCore::Parameter<int> volume_kill;
+extern ORCore::Parameter<int> volume_effects;
+extern ORCore::Parameter<int> volume_menu;
+
+
+extern ORCore::Parameter<int> game_hit_window_ms;
+
+
 extern ORCore::Parameter<std::string> debug_song1;
 extern ORCore::Parameter<std::string> debug_song2;
 extern ORCore::Parameter<std::string> debug_midi1;
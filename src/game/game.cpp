@@ -1,14 +1,30 @@
 #include "config.hpp"
 #include "game.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 
 #include "vfs.hpp"
+#include "configuration.hpp"
 namespace ORGame
 {
     const float neck_speed_divisor = 1.0;
 
+    // Bar lines are generated for this many seconds around the song time.
+    const double bar_window_behind = 0.5;
+    const double bar_window_ahead = 3.0;
+    const size_t bar_pool_size = 64;
+
+    // These should come from the controller configuration once it is read.
+    const std::map<ORCore::KeyCode, NoteType> fretKeyMap {
+        {ORCore::KeyCode::KEY_F1, NoteType::Green},
+        {ORCore::KeyCode::KEY_F2, NoteType::Red},
+        {ORCore::KeyCode::KEY_F3, NoteType::Yellow},
+        {ORCore::KeyCode::KEY_F4, NoteType::Blue},
+        {ORCore::KeyCode::KEY_F5, NoteType::Orange},
+    };
+
     GameManager::GameManager()
     :m_width(800),
     m_height(600),
@@ -49,18 +65,23 @@ namespace ORGame
         //VFS.Mount( ORCore::GetHomePath().c_str(), "" );
 
         //ORCore::mount( "./data", "data" );
-        m_song.load();
+
+        // The song is loaded in the background while the window shows the loading bar,
+        // everything that depends on it is set up by prep_song once it is ready.
+        m_loading = true;
+        m_songTime = 0.0;
+        m_songStartTime = 0.0;
+        m_heldLanes = 0;
+        m_songLoad = m_song.load_async("notes.mid", [this](SongLoadStage stage, float progress)
+        {
+            m_logger->debug(_("Song loading stage {} at {}%"), static_cast<int>(stage), static_cast<int>(progress*100));
+        });
 
         //std::cout << "Song: " << (m_song.length() / 1000) / 60 << " minutes long" << std::endl;
 
         //ORCore::Track *track = m_song.getTrack( ORCore::TrackType::Guitar, ORCore::Difficulty::Expert );
         //std::cout << "Song: loaded track for " << ORCore::TrackNameForType( track->info().type ) << std::endl;
 
-        m_tempoTrack = m_song.get_tempo_track();
-
-        m_song.load_tracks();
-        m_playerTrack = &(*m_song.get_tracks())[0];
-
         if(!gladLoadGL())
         {
             throw std::runtime_error(_("Error: GLAD failed to load."));
@@ -89,6 +110,51 @@ namespace ORGame
         resize(m_width, m_height);
         // glEnable(GL_DEPTH_TEST);
 
+        ORCore::RenderObject obj;
+        obj.set_program(m_program);
+        obj.set_primitive_type(ORCore::Primitive::triangle);
+
+        obj.set_texture(m_fretsTexture);
+        obj.set_scale(glm::vec3{1.0f, 1.0f, 0.05f});
+        obj.set_translation(glm::vec3{0.0f, 0.0f, -1.0f}); // center the line on the screen
+        obj.set_primitive_type(ORCore::Primitive::triangle);
+        obj.set_geometry(ORCore::create_rect_z_center_mesh(glm::vec4{1.0f,1.0f,1.0f,1.0f}));
+        m_fretObj = m_renderer.add_object(obj);
+
+        // Grows across the neck as the song loads.
+        obj.set_texture(-1);
+        obj.set_scale(glm::vec3{0.0f, 1.0f, 0.05f});
+        obj.set_translation(glm::vec3{0.0f, 0.0f, 0.0f});
+        m_loadingObj = m_renderer.add_object(obj);
+
+        m_renderer.commit();
+
+        GLint  iMultiSample = 0;
+        GLint  iNumSamples = 0;
+        glGetIntegerv(GL_SAMPLE_BUFFERS, &iMultiSample);
+        glGetIntegerv(GL_SAMPLES, &iNumSamples);
+
+        m_logger->info("GL_SAMPLE_BUFFERS: {}, GL_SAMPLES: {} ", iMultiSample, iNumSamples);
+
+        glClearColor(0.5, 0.5, 0.5, 1.0);
+    }
+
+    GameManager::~GameManager()
+    {
+        // The load callback logs through m_logger, which goes before the song does.
+        if (m_songLoad.valid())
+        {
+            m_songLoad.get_future().wait();
+        }
+        m_window.make_current(nullptr);
+    }
+
+    void GameManager::prep_song()
+    {
+        m_tempoTrack = m_song.get_tempo_track();
+        m_playerTrack = &(*m_song.get_tracks())[0];
+        m_judge = std::make_unique<Judge>(*m_playerTrack, game_hit_window_ms.getValue() / 1000.0);
+
         ORCore::RenderObject obj;
         obj.set_program(m_program);
         obj.set_primitive_type(ORCore::Primitive::triangle);
@@ -132,65 +198,81 @@ namespace ORGame
         prep_render_bars();
 
         prep_render_notes();
+    }
 
-        obj.set_texture(m_fretsTexture);
-        obj.set_scale(glm::vec3{1.0f, 1.0f, 0.05f});
-        obj.set_translation(glm::vec3{0.0f, 0.0f, -1.0f}); // center the line on the screen
+    void GameManager::prep_render_bars()
+    {
+        // reuse the same container when creating bars as add_obj wont modify the original.
+        ORCore::RenderObject obj;
+        obj.set_texture(m_texture);
+        obj.set_program(m_program);
         obj.set_primitive_type(ORCore::Primitive::triangle);
         obj.set_geometry(ORCore::create_rect_z_center_mesh(glm::vec4{1.0f,1.0f,1.0f,1.0f}));
-        m_fretObj = m_renderer.add_object(obj);
-
-        m_renderer.commit();
 
-        GLint  iMultiSample = 0;
-        GLint  iNumSamples = 0;
-        glGetIntegerv(GL_SAMPLE_BUFFERS, &iMultiSample);
-        glGetIntegerv(GL_SAMPLES, &iNumSamples);
+        // Unused bars are scaled down to nothing.
+        obj.set_scale(glm::vec3{0.0f, 0.0f, 0.0f});
 
-        m_logger->info("GL_SAMPLE_BUFFERS: {}, GL_SAMPLES: {} ", iMultiSample, iNumSamples);
-
-        glClearColor(0.5, 0.5, 0.5, 1.0);
-    }
+        while (m_barObjs.size() < bar_pool_size)
+        {
+            m_barObjs.push_back(m_renderer.add_object(obj));
+        }
 
-    GameManager::~GameManager()
-    {
-        m_window.make_current(nullptr);
+        m_barsInWindow.reserve(bar_pool_size);
+        m_barWindowFirst = -1.0;
+        m_barWindowCount = 0;
     }
 
-    void GameManager::prep_render_bars()
+    void GameManager::update_bars()
     {
+        m_tempoTrack->get_bars(m_songTime - bar_window_behind, m_songTime + bar_window_ahead, m_barsInWindow);
 
-        std::vector<BarEvent*> bars = m_tempoTrack->get_bars();
-        std::cout << "Bar Count: " << bars.size() << " Song Length: " << m_song.length() << std::endl;
-
-        // reuse the same container when creating bars as add_obj wont modify the original.
-        ORCore::RenderObject obj;
-        obj.set_texture(m_texture);
-        obj.set_program(m_program);
-
-        for (size_t i = 0; i < bars.size(); i++) {
-            float z = (bars[i]->time / neck_speed_divisor);
+        // The bars only change when one scrolls in or out of the window.
+        double first = m_barsInWindow.empty() ? -1.0 : m_barsInWindow.front().time;
+        if (first == m_barWindowFirst && m_barsInWindow.size() == m_barWindowCount)
+        {
+            return;
+        }
+        m_barWindowFirst = first;
+        m_barWindowCount = m_barsInWindow.size();
 
-            if (bars[i]->type == BarType::measure)
+        // Very fast or compound tempos can need more bars than the pool started with.
+        if (m_barsInWindow.size() > m_barObjs.size())
+        {
+            ORCore::RenderObject obj = *m_renderer.get_object(m_barObjs[0]);
+            while (m_barObjs.size() < m_barsInWindow.size())
             {
-                obj.set_scale(glm::vec3{1.0f, 1.0f, 0.021});
+                m_barObjs.push_back(m_renderer.add_object(obj));
+            }
+        }
+
+        for (size_t i = 0; i < m_barObjs.size(); i++) {
+            auto *obj = m_renderer.get_object(m_barObjs[i]);
 
-            } else 
+            if (i < m_barsInWindow.size())
             {
-                obj.set_scale(glm::vec3{1.0f, 1.0f, 0.007});
+                auto &bar = m_barsInWindow[i];
+                float z = (bar.time / neck_speed_divisor);
+
+                if (bar.type == BarType::measure)
+                {
+                    obj->set_scale(glm::vec3{1.0f, 1.0f, 0.021});
+                } else
+                {
+                    obj->set_scale(glm::vec3{1.0f, 1.0f, 0.007});
+                }
+                obj->set_translation(glm::vec3{0.0, 0.0f, -z});
+            } else {
+                obj->set_scale(glm::vec3{0.0f, 0.0f, 0.0f});
             }
 
-            obj.set_translation(glm::vec3{0.0, 0.0f, -z}); // center the line on the screen
-            obj.set_primitive_type(ORCore::Primitive::triangle);
-            obj.set_geometry(ORCore::create_rect_z_center_mesh(glm::vec4{1.0f,1.0f,1.0f,1.0f}));
-
-            m_renderer.add_object(obj);
+            m_renderer.update_object(m_barObjs[i]);
         }
     }
 
     void GameManager::prep_render_notes()
     {
-        std::vector<TrackNote*> notes = m_playerTrack->get_notes();
+        TrackNotes &notes = *m_playerTrack->get_note_data();
+        std::vector<NoteObjects> &noteObjects = *m_playerTrack->get_note_objects();
         std::cout << "Note Count: " << notes.size() << std::endl;
 
         // reuse the same container when creating notes as add_obj wont modify the original.
@@ -200,33 +282,34 @@ namespace ORGame
         float noteWidth = 1.0f/5.0f;
         float tailWidth = noteWidth/3.0f;
 
-        for (auto &note : notes)
+        for (size_t i = 0; i < notes.size(); i++)
         {
-            float z = note->time / neck_speed_divisor;
+            NoteType type = lane_note_type(notes.lane[i]);
+            float z = notes.time[i] / neck_speed_divisor;
             glm::vec4 color;
             try {
-                color = noteColorMap.at(note->type);
+                color = noteColorMap.at(type);
             } catch (std::out_of_range &err) {
                 color = glm::vec4{1.0f,1.0f,1.0f,1.0f};
             }
 
-            float noteLength = note->length/neck_speed_divisor;
+            float noteLength = notes.length[i]/neck_speed_divisor;
 
             obj.set_scale(glm::vec3{tailWidth, 1.0f, -noteLength});
-            obj.set_translation(glm::vec3{(static_cast<int>(note->type)*noteWidth) - noteWidth+tailWidth, 0.0f, -z}); // center the line on the screen
+            obj.set_translation(glm::vec3{(static_cast<int>(type)*noteWidth) - noteWidth+tailWidth, 0.0f, -z}); // center the line on the screen
             obj.set_primitive_type(ORCore::Primitive::triangle);
             obj.set_geometry(ORCore::create_rect_z_mesh(color));
             obj.set_texture(m_tailTexture);
 
-            note->objTailID = m_renderer.add_object(obj);
+            noteObjects[i].tail = m_renderer.add_object(obj);
             obj.set_texture(-1); // -1 gets set to the default texture.
 
             obj.set_scale(glm::vec3{noteWidth, tailWidth/2.0f, tailWidth/2.0f});
-            obj.set_translation(glm::vec3{(static_cast<int>(note->type)*noteWidth) - noteWidth, 0.0f, -z}); // center the line on the screen
+            obj.set_translation(glm::vec3{(static_cast<int>(type)*noteWidth) - noteWidth, 0.0f, -z}); // center the line on the screen
             obj.set_primitive_type(ORCore::Primitive::triangle);
             obj.set_geometry(ORCore::create_cube_mesh(color));
 
-            note->objNoteID = m_renderer.add_object(obj);
+            noteObjects[i].note = m_renderer.add_object(obj);
 
         }
     }
@@ -286,7 +369,21 @@ namespace ORGame
             }
             case ORCore::KeyDown: {
                 auto ev = ORCore::event_cast<ORCore::KeyDownEvent>(event);
+                if (ev.repeat) {
+                    break;
+                }
+                auto fret = fretKeyMap.find(ev.key);
+                if (fret != fretKeyMap.end()) {
+                    m_heldLanes |= lane_bit(fret->second);
+                    break;
+                }
                 switch(ev.key) {
+                    case ORCore::KeyCode::KEY_RETURN:
+                    case ORCore::KeyCode::KEY_RIGHT_SHIFT:
+                        if (m_judge) {
+                            handle_judge_event(m_judge->strum(event.time - m_songStartTime, m_heldLanes));
+                        }
+                        break;
                     case ORCore::KeyCode::KEY_F:
                         std::cout << "Key F" << std::endl;
                         break;
@@ -294,6 +391,15 @@ namespace ORGame
                         std::cout << "Other Key" << std::endl;
                         break;
                 }
+                break;
+            }
+            case ORCore::KeyUp: {
+                auto ev = ORCore::event_cast<ORCore::KeyUpEvent>(event);
+                auto fret = fretKeyMap.find(ev.key);
+                if (fret != fretKeyMap.end()) {
+                    m_heldLanes &= ~lane_bit(fret->second);
+                }
+                break;
             }
             default:
                 break;
@@ -305,36 +411,88 @@ namespace ORGame
     {
     }
 
-    void GameManager::update()
+    void GameManager::update_loading()
     {
-        // TODO - move songtime to song class, and create a new timer type which can be started and stopped/paused/rewound etc\.
-        m_songTime = m_clock.get_current_time()/1000.0;
+        // Each stage counts for an equal part of the bar.
+        SongLoadProgress loadProgress = m_songLoad.get_progress();
+        float progress = (static_cast<int>(loadProgress.stage) + loadProgress.progress) / static_cast<int>(SongLoadStage::Done);
 
-        auto notesInWindow = m_playerTrack->get_notes_in_frame(m_songTime-0.020, m_songTime+0.100);
-        for (auto *note : notesInWindow)
+        bool ready = m_songLoad.is_ready();
+
+        // Rethrows anything that went wrong while loading.
+        if (ready)
         {
-            if (!note->played && note->time <= m_songTime)
-            {
-                auto *tailObj = m_renderer.get_object(note->objTailID);
-                auto *noteObj = m_renderer.get_object(note->objNoteID);
-
-                glm::vec4 color;
-                try {
-                    color = noteColorMapActive.at(note->type);
-                } catch (std::out_of_range &err) {
-                    color = glm::vec4{1.0f,1.0f,1.0f,1.0f};
-                }
+            m_songLoad.get();
+            progress = 0.0f;
+        }
+
+        auto *loadingObj = m_renderer.get_object(m_loadingObj);
+        loadingObj->set_scale(glm::vec3{std::min(progress, 1.0f), ready ? 0.0f : 1.0f, 0.05f});
+        m_renderer.update_object(m_loadingObj);
+
+        if (ready)
+        {
+            prep_song();
+            m_loading = false;
+            m_songStartTime = ORCore::get_event_time();
+            m_logger->info(_("Song loaded"));
+        }
+    }
+
+    void GameManager::handle_judge_event(const JudgeEvent &judgeEvent)
+    {
+        m_logger->debug(_("Judged {} at {} ({} ms)"), static_cast<int>(judgeEvent.result), judgeEvent.time, judgeEvent.delta * 1000.0);
+
+        if (judgeEvent.result != JudgeResult::Hit)
+        {
+            return;
+        }
 
-                tailObj->set_geometry(ORCore::create_rect_z_mesh(color));
-                // noteObj->set_geometry(ORCore::create_cube_mesh(color));
-                //tailObj->set_scale(glm::vec3(1.0f,1.0f,1.0f));
-                //noteObj->set_scale(glm::vec3(1.0f,1.0f,1.0f));
+        const TrackChord &chord = m_judge->get_chord(judgeEvent.chord);
+        TrackNotes &notes = *m_playerTrack->get_note_data();
+        std::vector<NoteObjects> &noteObjects = *m_playerTrack->get_note_objects();
+        for (uint32_t i = chord.firstNote; i < chord.firstNote + chord.noteCount; i++)
+        {
+            auto *tailObj = m_renderer.get_object(noteObjects[i].tail);
 
-                m_renderer.update_object(note->objTailID);
-                m_renderer.update_object(note->objNoteID);
-                note->played = true;
+            glm::vec4 color;
+            try {
+                color = noteColorMapActive.at(lane_note_type(notes.lane[i]));
+            } catch (std::out_of_range &err) {
+                color = glm::vec4{1.0f,1.0f,1.0f,1.0f};
             }
+
+            tailObj->set_geometry(ORCore::create_rect_z_mesh(color));
+            // noteObj->set_geometry(ORCore::create_cube_mesh(color));
+            //tailObj->set_scale(glm::vec3(1.0f,1.0f,1.0f));
+
+            m_renderer.update_object(noteObjects[i].tail);
+            m_renderer.update_object(noteObjects[i].note);
         }
+    }
+
+    void GameManager::update()
+    {
+        if (m_loading)
+        {
+            update_loading();
+            m_renderer.commit();
+            m_renderer.set_camera_transform("ortho", glm::translate(m_rotPerspective, glm::vec3(-0.5f, -1.0f, -0.5f)));
+            return;
+        }
+
+        // TODO - move songtime to song class, and create a new timer type which can be started and stopped/paused/rewound etc\.
+        // Taken from the event clock so misses and strums agree on the song time.
+        m_songTime = ORCore::get_event_time() - m_songStartTime;
+
+        m_judgeEvents.clear();
+        m_judge->update(m_songTime, m_judgeEvents);
+        for (auto &judgeEvent : m_judgeEvents)
+        {
+            handle_judge_event(judgeEvent);
+        }
+
+        update_bars();
 
         auto frets = m_renderer.get_object(m_fretObj);
 
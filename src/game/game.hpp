@@ -2,6 +2,7 @@
 #include <vector>
 #include <ios>
 #include <map>
+#include <memory>
 
 #include "window.hpp"
 #include "context.hpp"
@@ -11,6 +12,7 @@
 #include "renderer/renderer.hpp"
 #include "renderer/texture.hpp"
 #include "song.hpp"
+#include "judge.hpp"
 
 #include <spdlog/spdlog.h>
 
@@ -42,8 +44,12 @@ namespace ORGame
         void start();
         bool event_handler(const ORCore::Event &event);
         void handle_song();
+        void prep_song();
+        void update_loading();
+        void handle_judge_event(const JudgeEvent &judgeEvent);
         void update();
         void prep_render_bars();
+        void update_bars();
         void prep_render_notes();
         void render();
         void resize(int width, int height);
@@ -61,8 +67,16 @@ namespace ORGame
         TempoTrack *m_tempoTrack;
         Track *m_playerTrack;
         double m_songTime;
+        // Song start in event time. Song time and strums both count from it, so
+        // strums are judged by when they happened rather than by frame.
+        double m_songStartTime;
+        bool m_loading;
 
         Song m_song;
+        SongLoad m_songLoad;
+        std::unique_ptr<Judge> m_judge;
+        std::vector<JudgeEvent> m_judgeEvents;
+        uint8_t m_heldLanes;
         ORCore::FpsTimer m_clock;
 
         ORCore::Context m_context;
@@ -77,6 +91,13 @@ namespace ORGame
         int m_soloNeckTexture;
         int m_program;
         int m_fretObj;
+        int m_loadingObj;
+
+        // Bar lines are only generated around the song time, these render objects get reused for them.
+        std::vector<int> m_barObjs;
+        std::vector<BarEvent> m_barsInWindow;
+        double m_barWindowFirst;
+        size_t m_barWindowCount;
 
         std::shared_ptr<spdlog::logger> m_logger;
 
@@ -0,0 +1,121 @@
+#include "config.hpp"
+#include "judge.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ORGame
+{
+    Judge::Judge(Track &track, double hitWindow)
+    : m_track(&track),
+    m_chords(*track.get_chords()),
+    m_judged(m_chords.size(), 0),
+    m_nextChord(0),
+    m_hitWindow(hitWindow)
+    {
+    }
+
+    // Chords need exactly their frets held. Single notes can also have lower frets
+    // held so players can anchor.
+    bool Judge::lanes_match(const TrackChord &chord, uint8_t lanes)
+    {
+        if (chord.noteCount > 1 || (chord.lanes & (chord.lanes - 1)) != 0)
+        {
+            return lanes == chord.lanes;
+        }
+        return (lanes & chord.lanes) != 0 && (lanes & ~((chord.lanes << 1) - 1)) == 0;
+    }
+
+    JudgeEvent Judge::strum(double time, uint8_t lanes)
+    {
+        // Chord times are floats, rounding the strum the same way puts a strum on a chord's time exactly on it.
+        time = static_cast<float>(time);
+
+        // The first chord that could still be hit, everything before it is out of the window.
+        auto first = std::lower_bound(m_chords.begin() + m_nextChord, m_chords.end(), time - m_hitWindow,
+            [](const TrackChord &chord, double windowStart) { return chord.time < windowStart; });
+
+        // Of the unjudged chords in the window, take the one nearest to the strum that the frets match.
+        auto best = m_chords.end();
+        for (auto chord = first; chord != m_chords.end() && chord->time <= time + m_hitWindow; ++chord)
+        {
+            if (m_judged[chord - m_chords.begin()] || !lanes_match(*chord, lanes))
+            {
+                continue;
+            }
+            if (best == m_chords.end() || std::abs(chord->time - time) < std::abs(best->time - time))
+            {
+                best = chord;
+            }
+        }
+
+        if (best != m_chords.end())
+        {
+            int index = static_cast<int>(best - m_chords.begin());
+            m_judged[index] = 1;
+
+            std::vector<uint8_t> &played = *m_track->get_played();
+            for (uint32_t i = 0; i < best->noteCount; i++)
+            {
+                played[best->firstNote + i] = 1;
+            }
+
+            return {JudgeResult::Hit, time, time - best->time, index};
+        }
+
+        // Nothing to hit, report how far off the nearest unjudged chord on either side the strum was.
+        auto ahead = std::upper_bound(m_chords.begin() + m_nextChord, m_chords.end(), time,
+            [](double strumTime, const TrackChord &chord) { return strumTime < chord.time; });
+        auto behind = ahead;
+
+        while (ahead != m_chords.end() && m_judged[ahead - m_chords.begin()])
+        {
+            ++ahead;
+        }
+        while (behind != m_chords.begin() + m_nextChord && m_judged[behind - 1 - m_chords.begin()])
+        {
+            --behind;
+        }
+
+        auto nearest = ahead;
+        if (behind != m_chords.begin() + m_nextChord)
+        {
+            --behind;
+            if (ahead == m_chords.end() || time - behind->time < ahead->time - time)
+            {
+                nearest = behind;
+            }
+        }
+
+        if (nearest == m_chords.end())
+        {
+            return {JudgeResult::Late, time, 0.0, -1};
+        }
+
+        double delta = time - nearest->time;
+        int index = static_cast<int>(nearest - m_chords.begin());
+        return {delta < 0.0 ? JudgeResult::Early : JudgeResult::Late, time, delta, index};
+    }
+
+    void Judge::update(double time, std::vector<JudgeEvent> &misses)
+    {
+        for (; m_nextChord < m_chords.size() && m_chords[m_nextChord].time + m_hitWindow < time; m_nextChord++)
+        {
+            if (!m_judged[m_nextChord])
+            {
+                m_judged[m_nextChord] = 1;
+                misses.push_back({JudgeResult::Miss, time, time - m_chords[m_nextChord].time, static_cast<int>(m_nextChord)});
+            }
+        }
+    }
+
+    const TrackChord &Judge::get_chord(int index)
+    {
+        return m_chords[index];
+    }
+
+    double Judge::get_hit_window()
+    {
+        return m_hitWindow;
+    }
+} // namespace ORGame
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "song.hpp"
+
+namespace ORGame
+{
+    enum class JudgeResult
+    {
+        Hit,
+        // A strum that didn't hit anything, before or after the nearest chord.
+        Early,
+        Late,
+        // A chord whose hit window passed without it being hit.
+        Miss,
+    };
+
+    struct JudgeEvent
+    {
+        JudgeResult result;
+        double time;
+        // Time of the judged input minus the time of the nearest chord, negative when early.
+        double delta;
+        // Index of the nearest chord, -1 if there are no chords left to compare against.
+        int chord;
+    };
+
+    // Judges timestamped input against the chords of a track, each chord is judged as one. Times are song times in
+    // seconds, taken from when the input happened rather than when it was processed.
+    class Judge
+    {
+    public:
+        Judge(Track &track, double hitWindow);
+
+        // Judge a strum with the frets in lanes held down. A strum on a chord's time has a delta of exactly 0.
+        JudgeEvent strum(double time, uint8_t lanes);
+
+        // Mark the chords whose window ended before time as missed, appending them to misses.
+        void update(double time, std::vector<JudgeEvent> &misses);
+
+        const TrackChord &get_chord(int index);
+        double get_hit_window();
+
+    private:
+        bool lanes_match(const TrackChord &chord, uint8_t lanes);
+
+        Track *m_track;
+        const std::vector<TrackChord> &m_chords;
+        // Set once a chord has been hit or missed, indexed like the chords.
+        std::vector<uint8_t> m_judged;
+        // Every chord before this has been judged.
+        size_t m_nextChord;
+        double m_hitWindow;
+    };
+} // namespace ORGame
@@ -1,8 +1,13 @@
 #include "config.hpp"
 #include <stdexcept>
 #include <algorithm>
-#include <iostream>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <thread>
 #include "song.hpp"
+#include "songcache.hpp"
+#include "parallel.hpp"
 
 #include "vfs.hpp"
 
@@ -12,6 +17,84 @@ namespace ORGame
 
     static std::shared_ptr<spdlog::logger> logger;
 
+    // How far a cursor is stepped forward one element at a time before
+    // falling back to a binary search, a window usually moves only a few
+    // elements per frame.
+    const size_t cursorScanLimit = 8;
+
+    // Returns the first element of the time sorted items that isn't before,
+    // starting from where the cursor was left.
+    template<typename T, typename Pred>
+    static size_t seek_cursor(const std::vector<T> &items, size_t cursor, Pred before)
+    {
+        cursor = std::min(cursor, items.size());
+
+        // Seeking backwards, after a rewind or a restart.
+        if (cursor > 0 && !before(items[cursor - 1]))
+        {
+            return std::partition_point(items.begin(), items.begin() + cursor, before) - items.begin();
+        }
+
+        size_t limit = std::min(items.size(), cursor + cursorScanLimit);
+        while (cursor < limit && before(items[cursor]))
+        {
+            cursor++;
+        }
+
+        // Still not there, this was a seek forwards.
+        if (cursor < items.size() && before(items[cursor]))
+        {
+            return std::partition_point(items.begin() + cursor, items.end(), before) - items.begin();
+        }
+        return cursor;
+    }
+
+    static double item_time(const TempoEvent &item)
+    {
+        return item.time;
+    }
+
+    // The range of items with start <= time <= end.
+    template<typename T>
+    static TrackRange find_window(const std::vector<T> &items, TrackCursor &cursor, double start, double end)
+    {
+        cursor.start = seek_cursor(items, cursor.start, [&](const T &item) { return item_time(item) < start; });
+        cursor.end = seek_cursor(items, cursor.end, [&](const T &item) { return item_time(item) <= end; });
+        cursor.end = std::max(cursor.start, cursor.end);
+        return {cursor.start, cursor.end};
+    }
+
+    uint8_t lane_bit(NoteType type)
+    {
+        if (type == NoteType::NONE)
+        {
+            return 0;
+        }
+        return static_cast<uint8_t>(1 << (static_cast<int>(type) - static_cast<int>(NoteType::Green)));
+    }
+
+    NoteType lane_note_type(uint8_t laneBit)
+    {
+        for (int type = static_cast<int>(NoteType::Green); type <= static_cast<int>(NoteType::Orange); type++)
+        {
+            if (laneBit == lane_bit(static_cast<NoteType>(type)))
+            {
+                return static_cast<NoteType>(type);
+            }
+        }
+        return NoteType::NONE;
+    }
+
+    size_t TrackNotes::size() const
+    {
+        return count;
+    }
+
+    size_t TrackRange::size() const
+    {
+        return end - start;
+    }
+
     /////////////////////////////////////
     // TempoTrack Class methods
     /////////////////////////////////////
@@ -74,116 +157,116 @@ namespace ORGame
         }
     }
 
-    std::vector<TempoEvent*> TempoTrack::get_events(double start, double end)
+    TrackView<TempoEvent> TempoTrack::get_events(double start, double end)
     {
-        std::vector<TempoEvent*> events;
-        for (auto &tempo : m_tempo) {
-            if (tempo.time >= start && tempo.time <= end) {
-                events.push_back(&tempo);
-            }
-        }
-        return events;
+        TrackRange range = find_window(m_tempo, m_tempoCursor, start, end);
+        return {m_tempo.data(), range.start, range.end};
     }
 
-    std::vector<TempoEvent*> TempoTrack::get_events()
+    TrackView<TempoEvent> TempoTrack::get_events()
     {
-        std::vector<TempoEvent*> events;
-        for (auto &tempo : m_tempo) {
-            events.push_back(&tempo);
-        }
-        return events;
+        return {m_tempo.data(), 0, m_tempo.size()};
     }
 
+    // Beat positions closer than this to a whole beat are snapped to it, so a
+    // tempo change placed on a beat doesn't create a second line next to it.
+    const double beatEpsilon = 1e-6;
+
     void TempoTrack::mark_bars()
     {
-        TempoEvent *currentTempo = nullptr;
-        double beatSubdivision = 1.0; // How many times to subdivide the beat
-        double measureCount = 0.0;
-        double beatTsFactor = 1.0;
-        double incr = 0.0;
-        int interMeasureBeatCount = 0;
-        bool timeSigChanged = true;
-        for (auto &nextTempo : m_tempo)
-        {
+        m_barSegments.clear();
+        m_barSegments.reserve(m_tempo.size());
 
-            if (currentTempo == nullptr)
+        for (size_t i = 0; i < m_tempo.size(); i++)
+        {
+            auto &tempo = m_tempo[i];
+
+            // Midi defaults to 4/4 at 120bpm until told otherwise.
+            int numerator = tempo.numerator > 0 ? tempo.numerator : 4;
+            int denominator = tempo.denominator > 0 ? tempo.denominator : 4;
+            int qnLength = tempo.qnLength > 0 ? tempo.qnLength : 500'000;
+
+            BarSegment segment;
+            segment.time = tempo.time;
+            segment.beatLength = (qnLength / 1'000'000.0) * (4.0 / denominator);
+            segment.numerator = numerator;
+            segment.beatOffset = 0.0;
+
+            // A time signature change starts a new measure, otherwise the part of a beat
+            // left over from the previous segment is carried over so no time is lost.
+            if (i > 0 && tempo.numerator == m_tempo[i-1].numerator && tempo.denominator == m_tempo[i-1].denominator)
             {
-                currentTempo = &nextTempo;
-                std::cout << "Tempo change info" << currentTempo->numerator << " " << currentTempo->denominator << " " << currentTempo->qnLength << std::endl;
-                continue;
+                auto &previous = m_barSegments.back();
+                double beatOffset = previous.beatOffset + (segment.time - previous.time) / previous.beatLength;
+                double nearest = std::round(beatOffset);
+                segment.beatOffset = std::abs(beatOffset - nearest) < beatEpsilon ? nearest : beatOffset;
             }
 
-            beatTsFactor = 4.0/currentTempo->denominator;
-
-            incr = (currentTempo->qnLength / (beatSubdivision*1'000'000.0)) * beatTsFactor;
+            m_barSegments.push_back(segment);
+        }
+    }
 
-            double beats = ((nextTempo.time - currentTempo->time) / incr);
+    void TempoTrack::get_bars(double start, double end, std::vector<BarEvent> &bars)
+    {
+        bars.clear();
+        if (m_barSegments.empty() || end < start)
+        {
+            return;
+        }
 
-            double measures = ( beats / currentTempo->numerator);
+        // Start from the segment containing start, or the first one if start is before it.
+        auto segment = std::upper_bound(m_barSegments.begin(), m_barSegments.end(), start,
+            [](double time, const BarSegment &item) { return time < item.time; });
+        if (segment != m_barSegments.begin())
+        {
+            --segment;
+        }
 
-            std::cout << "Measures in change: " << measures << " beats " << beats << std::endl;
+        for (; segment != m_barSegments.end() && segment->time <= end; ++segment)
+        {
+            auto next = segment + 1;
 
-            if (measures < 1)
+            // Beats at the start of the next segment belong to it.
+            double lastBeat = std::floor(segment->beatOffset + (end - segment->time) / segment->beatLength + beatEpsilon);
+            if (next != m_barSegments.end())
             {
-                std::cout << "Tempo change info" << currentTempo->numerator << " " << currentTempo->denominator << " " << currentTempo->qnLength << std::endl;
+                double nextBeat = segment->beatOffset + (next->time - segment->time) / segment->beatLength;
+                lastBeat = std::min(lastBeat, std::ceil(nextBeat - beatEpsilon) - 1.0);
             }
 
-            // One thing that needs to happen here, if we have tempo changes that are less than a beat we need to accumulate the time between them
-            // and create the next beat at that point. Beat lines should be always generated from the previous beat's position. However to generate
-            // long stretches of beat lines we should generate those based on multiplication to reduce rounding errors.
-            // To make that work we cannot base the multiplication based on the current tempo position, but instead tempoMarkingPeriodBegin.
-            // tempoMarkingPeriodBegin will be the position of the last committed beat line.
-            // a beat line will only be committed to tempoMarkingPeriodBegin when we have reached the last whole markable beat in a time period.
-            // The remaining time between this final beat, and the next tempo change will be rolled over into the next beat period.
-            // We need to forget thinking in terms of "beats" and instead think in terms of time. We cannot lose time.
+            double firstBeat = std::ceil(segment->beatOffset - beatEpsilon);
+            firstBeat = std::max(firstBeat, std::ceil(segment->beatOffset + (start - segment->time) / segment->beatLength - beatEpsilon));
 
-            measureCount = static_cast<int>(((nextTempo.time - currentTempo->time) / incr) / currentTempo->numerator);
-
-            for (int i=0; i < static_cast<int>(beats)+1; i++)
+            // Each line is placed by multiplying out from the segment start so rounding errors don't build up.
+            for (double beat = firstBeat; beat <= lastBeat; beat += 1.0)
             {
-                if (interMeasureBeatCount == 0)
-                {
-                    m_bars.push_back({BarType::measure, currentTempo->time + (incr*i)});
-                } else {
-                    m_bars.push_back({BarType::beat, currentTempo->time + (incr*i)});
-                }
-
-                interMeasureBeatCount++;
-                if (interMeasureBeatCount >= currentTempo->numerator)
-                {
-                    interMeasureBeatCount = 0;
-                }
-
+                double time = segment->time + (beat - segment->beatOffset) * segment->beatLength;
+                bool measure = std::fmod(beat, segment->numerator) == 0.0;
+                bars.push_back({measure ? BarType::measure : BarType::beat, time});
             }
+        }
+    }
 
-            if (currentTempo->numerator != nextTempo.numerator || currentTempo->denominator != nextTempo.denominator)
-            {
-                std::cout << "TS CHANGED MARKING" << std::endl;
-                interMeasureBeatCount = 0;
-            }
+    std::vector<TempoEvent> *TempoTrack::get_tempo_data()
+    {
+        return &m_tempo;
+    }
 
-            currentTempo = &nextTempo;
-        }
+    template<typename T>
+    static size_t vector_bytes(const std::vector<T> &items)
+    {
+        return items.capacity() * sizeof(T);
     }
 
-    std::vector<BarEvent*> TempoTrack::get_bars(double start, double end)
+    void TempoTrack::compact()
     {
-        std::vector<BarEvent*> events;
-        for (auto &bar : m_bars) {
-            if (bar.time >= start && bar.time <= end) {
-                events.push_back(&bar);
-            }
-        }
-        return events;
+        m_tempo.shrink_to_fit();
+        m_barSegments.shrink_to_fit();
     }
 
-    std::vector<BarEvent*> TempoTrack::get_bars()
+    size_t TempoTrack::retained_bytes()
     {
-        std::vector<BarEvent*> events;
-        for (auto &bar : m_bars) {
-            events.push_back(&bar);
-        }
-        return events;
+        return vector_bytes(m_tempo) + vector_bytes(m_barSegments);
     }
 
     /////////////////////////////////////
@@ -191,9 +274,12 @@ namespace ORGame
     /////////////////////////////////////
 
     Track::Track(TrackInfo info)
-    : m_info(info)
+    : m_info(info),
+    m_notes {nullptr, nullptr, nullptr, 0}
     {
         logger = spdlog::get("default");
+        m_openNotes.fill(-1);
+        m_openEvents.fill(-1);
     }
 
 
@@ -201,78 +287,197 @@ namespace ORGame
         return m_info;
     }
 
+    // A lane only holds one note at a time, so a note on in a lane that is
+    // still open ends the open note there.
     void Track::add_note(NoteType type, double time, bool on)
     {
-        static std::vector<std::pair<NoteType, int>> activeNotes;
+        int &open = m_openNotes[static_cast<size_t>(type)];
 
+        if (open != -1) {
+            m_noteLength[open] = static_cast<float>(time - m_noteTime[open]);
+            open = -1;
+        }
         if (on) {
-            int index = m_notes.size();
-            activeNotes.emplace_back(type, index);
-            m_notes.push_back({type, time, 0.0});
-        } else {
-            auto findFunc = [&](const auto& element)
-            {
-                return element.first == type;
-            };
-            auto item = std::find_if( activeNotes.begin(), activeNotes.end(), findFunc);
-            if (item != activeNotes.end())
-            {
-                auto &note = m_notes[item->second];
-                note.length = time - note.time;
-                activeNotes.erase(item);
-            }
+            open = static_cast<int>(m_noteTime.size());
+            m_noteTime.push_back(static_cast<float>(time));
+            m_noteLength.push_back(0.0f);
+            m_noteLane.push_back(lane_bit(type));
         }
     }
 
     void Track::set_event(EventType type, double time, bool on)
     {
-        static std::vector<std::pair<EventType, int>> activeEvents;
+        int &open = m_openEvents[static_cast<size_t>(type)];
 
+        if (open != -1) {
+            auto &event = m_events[open];
+            event.length = time - event.time;
+            open = -1;
+        }
         if (on) {
-            int index = m_events.size();
-            activeEvents.emplace_back(type, index);
+            open = static_cast<int>(m_events.size());
             m_events.push_back({type, time, 0.0});
-        } else {
-            auto findFunc = [&](const auto& element)
+        }
+    }
+
+    std::vector<Event> *Track::get_events()
+    {
+        return &m_events;
+    }
+
+    // The view of the track's own notes is refreshed on each call, so it is
+    // never left pointing at the storage of a track this one was copied from.
+    TrackNotes *Track::get_note_data()
+    {
+        if (!m_noteSource)
+        {
+            m_notes = {m_noteTime.data(), m_noteLength.data(), m_noteLane.data(), m_noteTime.size()};
+        }
+        return &m_notes;
+    }
+
+    void Track::set_note_data(TrackNotes notes, std::shared_ptr<ORCore::FileBuffer> source)
+    {
+        m_noteTime.clear();
+        m_noteLength.clear();
+        m_noteLane.clear();
+        m_noteSource = source;
+        m_notes = notes;
+    }
+
+    // Chords closer than this many quarter notes to the previous one can be
+    // hammered on, the 170 ticks at 480 ppqn most charts are authored against.
+    const double hopoThresholdQn = 170.0 / 480.0;
+
+    // Every note has some length, anything shorter than a sixteenth isn't a sustain.
+    const double sustainThresholdQn = 0.25;
+
+    // Midi defaults to 120bpm until told otherwise.
+    const double defaultQnSeconds = 0.5;
+
+    static double qn_seconds(const TempoEvent &tempo)
+    {
+        return tempo.qnLength > 0 ? tempo.qnLength / 1'000'000.0 : defaultQnSeconds;
+    }
+
+    // Notes are sorted by time, so the notes of a chord are next to each other.
+    // Gaps and lengths are measured in quarter notes, so they are judged the same
+    // on either side of a tempo change.
+    void Track::build_chords(TempoTrack &tempoTrack)
+    {
+        TrackView<TempoEvent> tempo = tempoTrack.get_events();
+        TrackNotes &notes = *get_note_data();
+
+        // Quarter notes from the start of the song to each tempo change.
+        std::vector<double> tempoQn(tempo.size());
+        for (size_t i = 0; i < tempo.size(); i++)
+        {
+            tempoQn[i] = i == 0 ? tempo[0].time / defaultQnSeconds :
+                tempoQn[i-1] + (tempo[i].time - tempo[i-1].time) / qn_seconds(tempo[i-1]);
+        }
+
+        auto time_to_qn = [&](double time)
+        {
+            const TempoEvent *first = tempo.items + tempo.start;
+            const TempoEvent *next = std::upper_bound(first, first + tempo.size(), time,
+                [](double itemTime, const TempoEvent &item) { return itemTime < item.time; });
+
+            // Before the first tempo change, or there are none.
+            if (next == first)
+            {
+                return time / defaultQnSeconds;
+            }
+            size_t index = (next - first) - 1;
+            return tempoQn[index] + (time - tempo[index].time) / qn_seconds(tempo[index]);
+        };
+
+        m_chords.clear();
+        for (size_t i = 0; i < notes.size(); i++)
+        {
+            if (m_chords.empty() || notes.time[i] != m_chords.back().time)
             {
-                return element.first == type;
-            };
-            auto item = std::find_if( activeEvents.begin(), activeEvents.end(), findFunc);
-            if (item != activeEvents.end())
+                m_chords.push_back({notes.time[i], notes.time[i], static_cast<uint32_t>(i), 0, 0, 0});
+            }
+            TrackChord &chord = m_chords.back();
+            chord.lanes |= notes.lane[i];
+            chord.sustainEnd = std::max(chord.sustainEnd, notes.time[i] + notes.length[i]);
+            chord.noteCount++;
+        }
+
+        double previousQn = 0.0;
+        for (size_t i = 0; i < m_chords.size(); i++)
+        {
+            TrackChord &chord = m_chords[i];
+            double chordQn = time_to_qn(chord.time);
+
+            if (time_to_qn(chord.sustainEnd) - chordQn >= sustainThresholdQn)
             {
-                auto &event = m_events[item->second];
-                event.length = time - event.time;
-                activeEvents.erase(item);
+                chord.flags |= ChordSustain;
+            } else {
+                chord.sustainEnd = chord.time;
             }
 
+            // Only single notes that change lane can be hammered on or pulled off.
+            if (i > 0 && (chord.lanes & (chord.lanes - 1)) == 0 && chord.lanes != m_chords[i-1].lanes &&
+                chordQn - previousQn <= hopoThresholdQn)
+            {
+                chord.flags |= ChordHopo;
+            }
+            previousQn = chordQn;
         }
     }
 
-    std::vector<Event> *Track::get_events()
+    std::vector<TrackChord> *Track::get_chords()
     {
-        return &m_events;
+        return &m_chords;
     }
 
-    // void set_
+    std::vector<NoteObjects> *Track::get_note_objects()
+    {
+        size_t noteCount = get_note_data()->size();
+        if (m_noteObjects.size() != noteCount)
+        {
+            m_noteObjects.resize(noteCount, {-1, -1});
+        }
+        return &m_noteObjects;
+    }
 
-    std::vector<TrackNote*> Track::get_notes_in_frame(double start, double end)
-    {   
-        std::vector<TrackNote*> notes;
-        for ( auto &note : m_notes) {
-            if (note.time >= start && note.time <= end) {
-                notes.emplace_back( &note );
-            }
+    std::vector<uint8_t> *Track::get_played()
+    {
+        size_t noteCount = get_note_data()->size();
+        if (m_played.size() != noteCount)
+        {
+            m_played.resize(noteCount, 0);
         }
-        return notes;
+        return &m_played;
+    }
+
+    void Track::compact()
+    {
+        m_noteTime.shrink_to_fit();
+        m_noteLength.shrink_to_fit();
+        m_noteLane.shrink_to_fit();
+        m_chords.shrink_to_fit();
+        m_events.shrink_to_fit();
     }
 
-    std::vector<TrackNote*> Track::get_notes()
-    {   
-        std::vector<TrackNote*> notes;
-        for ( auto &note : m_notes) {
-            notes.emplace_back( &note );
+    size_t Track::retained_bytes()
+    {
+        size_t bytes = vector_bytes(m_noteTime) + vector_bytes(m_noteLength) + vector_bytes(m_noteLane);
+
+        // Notes in the song cache are counted too, their pages stay resident while the track is played.
+        if (m_noteSource)
+        {
+            bytes += m_notes.size() * (sizeof(float) * 2 + sizeof(uint8_t));
         }
-        return notes;
+        return bytes + vector_bytes(m_chords) + vector_bytes(m_noteObjects) + vector_bytes(m_played) + vector_bytes(m_events);
+    }
+
+    // void set_
+
+    TrackRange Track::get_notes()
+    {
+        return {0, get_note_data()->size()};
     }
 
     using MidiNoteMap = std::map<int, NoteType>;
@@ -366,17 +571,68 @@ namespace ORGame
         }
     }
 
+    /////////////////////////////////////
+    // SongLoad Class methods
+    /////////////////////////////////////
+
+    SongLoad::SongLoad()
+    {
+    }
+
+    SongLoad::SongLoad(std::shared_ptr<SongLoadState> state)
+    : m_state(state)
+    {
+    }
+
+    bool SongLoad::valid()
+    {
+        return m_state != nullptr;
+    }
+
+    bool SongLoad::is_ready()
+    {
+        return m_state->future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    SongLoadProgress SongLoad::get_progress()
+    {
+        return m_state->progress;
+    }
+
+    void SongLoad::get()
+    {
+        m_state->future.get();
+    }
+
+    std::shared_future<void> SongLoad::get_future()
+    {
+        return m_state->future;
+    }
+
     /////////////////////////////////////
     // Song Class methods
     /////////////////////////////////////
 
     Song::Song(std::string songpath)
     : m_path(songpath),
-    m_midi("notes.mid")
+    m_midiPath("notes.mid"),
+    m_cachePath("notes.mid.cache"),
+    m_cacheLoaded(false),
+    m_compiled(false),
+    m_length(0.0)
     {
         logger = spdlog::get("default");
     }
 
+    // The loading thread works on this song, so it has to finish first.
+    Song::~Song()
+    {
+        if (m_loadState && m_loadState->future.valid())
+        {
+            m_loadState->future.wait();
+        }
+    }
+
     void Song::add( TrackType type, Difficulty difficulty )
     {
         if ( type < TrackType::Events ) {
@@ -386,7 +642,17 @@ namespace ORGame
 
     bool Song::load()
     {
-        const ORCore::TempoTrack &tempoTrack = *m_midi.get_tempo_track();
+        if (load_cache())
+        {
+            logger->debug(_("Song loaded from cache"));
+            return false;
+        }
+
+        report_progress(SongLoadStage::Midi, 0.0f);
+        m_midi = std::make_unique<ORCore::SmfReader>(m_midiPath);
+        report_progress(SongLoadStage::Midi, 0.5f);
+
+        const ORCore::TempoTrack &tempoTrack = *m_midi->get_tempo_track();
 
         for (auto &eventOrder : tempoTrack.tempoOrdering)
         {
@@ -394,8 +660,8 @@ namespace ORGame
             if (eventOrder.type == ORCore::TtOrderType::TimeSignature)
             {
                 auto &ts = tempoTrack.timeSignature[eventOrder.index];
-                m_tempoTrack.add_time_sig_event(ts.numerator, ts.denominator, ts.thirtySecondPQN/8.0, m_midi.pulsetime_to_abstime(ts.info.info.pulseTime));
-                logger->trace(_("Time signature change recieved at time {} {}/{}"), m_midi.pulsetime_to_abstime(ts.info.info.pulseTime), ts.numerator, ts.denominator);
+                m_tempoTrack.add_time_sig_event(ts.numerator, ts.denominator, ts.thirtySecondPQN/8.0, m_midi->pulsetime_to_abstime(ts.info.info.pulseTime));
+                logger->trace(_("Time signature change recieved at time {} {}/{}"), m_midi->pulsetime_to_abstime(ts.info.info.pulseTime), ts.numerator, ts.denominator);
             }
             else if (eventOrder.type == ORCore::TtOrderType::Tempo)
             {
@@ -407,14 +673,21 @@ namespace ORGame
 
         m_tempoTrack.mark_bars();
 
-        std::vector<ORCore::SmfTrack*> midiTracks = m_midi.get_tracks();
+        // Only the track names are needed here, so none of the tracks get decoded yet.
+        std::vector<std::string> trackNames = m_midi->get_track_names();
 
         bool foundUsable = false;
-        
-        for (auto midiTrack : midiTracks)
+
+        // Parts are added in this order whatever order the midi has them in, so
+        // guitar stays the first track. Vocal parts hold pitches rather than
+        // the five lanes of each difficulty, so they aren't loaded as tracks.
+        const std::array<TrackType, 3> laneParts {TrackType::Guitar, TrackType::Bass, TrackType::Drums};
+
+        for (TrackType type : laneParts)
         {
-            TrackType type = get_track_type(midiTrack->name);
-            if (type == TrackType::Guitar)
+            bool found = std::any_of(trackNames.begin(), trackNames.end(),
+                [&](const std::string &trackName) { return get_track_type(trackName) == type; });
+            if (found)
             {
                 // Add all difficulties for this track
                 add(type, Difficulty::Expert);
@@ -434,91 +707,286 @@ namespace ORGame
         return false;
     }
 
-    void Song::load_track(TrackInfo& trackInfo)
+    // Where a midi note number is routed to within a part.
+    struct NoteRoute
+    {
+        int track;
+        NoteType note;
+    };
+
+    // Loads every difficulty of a part in a single pass over its midi track.
+    // A note number dispatch table sends each note to its difficulty, and
+    // markers shared by all difficulties are applied to each of them.
+    // Returns the length of the part's midi track.
+    double Song::load_part(TrackType type)
     {
-        Track track(trackInfo);
+        std::array<NoteRoute, 128> routes;
+        routes.fill({-1, NoteType::NONE});
 
-        logger->debug(_("Loading Track {} {}"), track_type_to_name(trackInfo.type), diff_type_to_name(trackInfo.difficulty));
+        std::vector<int> partTracks;
 
-        std::vector<ORCore::SmfTrack*> midiTracks = m_midi.get_tracks();
+        for (size_t i = 0; i < m_tracks.size(); i++)
+        {
+            TrackInfo info = m_tracks[i].info();
+            if (info.type != type)
+            {
+                continue;
+            }
 
-        const MidiNoteMap &noteMap = midiDiffMap.at(trackInfo.difficulty);
+            logger->debug(_("Loading Track {} {}"), track_type_to_name(info.type), diff_type_to_name(info.difficulty));
 
-        NoteType note;
+            partTracks.push_back(static_cast<int>(i));
+            for (auto &lane : midiDiffMap.at(info.difficulty))
+            {
+                routes[lane.first] = {static_cast<int>(i), lane.second};
+            }
+        }
 
-        for (auto midiTrack : midiTracks)
+        for (auto &trackName : m_midi->get_track_names())
         {
-            TrackType type = get_track_type(midiTrack->name);
-            if (type == trackInfo.type)
+            if (get_track_type(trackName) != type)
+            {
+                continue;
+            }
+
+            // Events are handed over as the track is decoded, with their time already
+            // in seconds, so the track's events are never stored by the reader.
+            ORCore::SmfTrack midiTrack = m_midi->visit_track(trackName, [&](const ORCore::SmfVisitEvent &midiEvent)
             {
+                auto message = midiEvent.message();
+                if (message != ORCore::NoteOn && message != ORCore::NoteOff) {
+                    return;
+                }
 
-                for (auto &midiEvent : midiTrack->midiEvents)
-                {
-                    // TODO - Clean this up this WILL get very messy eventually.
-                    if (midiEvent.message == ORCore::NoteOn) {
-                        if (midiEvent.data1 == solo_marker) {
-                            if (midiEvent.data2 != 0)
-                            {
-                                track.set_event(EventType::solo, m_midi.pulsetime_to_abstime(midiEvent.info.pulseTime), true);
-                            } else {
-                                track.set_event(EventType::solo, m_midi.pulsetime_to_abstime(midiEvent.info.pulseTime), false);
-
-                            }
-                        } else if (midiEvent.data1 == drive_marker) {
-                            if (midiEvent.data2 != 0)
-                            {
-                                track.set_event(EventType::drive, m_midi.pulsetime_to_abstime(midiEvent.info.pulseTime), true);
-                            } else {
-                                track.set_event(EventType::drive, m_midi.pulsetime_to_abstime(midiEvent.info.pulseTime), false);
-                            }
-                        } else {
-                            try {
-                                note = noteMap.at(midiEvent.data1);
-                            } catch (std::out_of_range &err) {
-                                continue;
-                            }
-                            if (note != NoteType::NONE) {
-                                if (midiEvent.data2 != 0)
-                                {
-                                    track.add_note(note, m_midi.pulsetime_to_abstime(midiEvent.info.pulseTime), true);
-                                } else {
-                                    track.add_note(note, m_midi.pulsetime_to_abstime(midiEvent.info.pulseTime), false);
-                                }
-                            }
-                        }
-                    } else if (midiEvent.message == ORCore::NoteOff) {
-                        if (midiEvent.data1 == solo_marker) {
-                            track.set_event(EventType::solo, m_midi.pulsetime_to_abstime(midiEvent.info.pulseTime), false);
-                        } else if (midiEvent.data1 == drive_marker) {
-                            track.set_event(EventType::drive, m_midi.pulsetime_to_abstime(midiEvent.info.pulseTime), false);
-                        } else {
-                            try {
-                                note = noteMap.at(midiEvent.data1);
-                            } catch (std::out_of_range &err) {
-                                continue;
-                            }
-                            if (note != NoteType::NONE) {
-                                track.add_note(note, m_midi.pulsetime_to_abstime(midiEvent.info.pulseTime), false);
-                            }
-                        }
-                    }
+                // A NoteOn with a velocity of 0 is treated the same as a NoteOff.
+                bool on = message == ORCore::NoteOn && midiEvent.data2 != 0;
 
+                if (midiEvent.data1 == solo_marker) {
+                    for (int index : partTracks) {
+                        m_tracks[index].set_event(EventType::solo, midiEvent.time, on);
+                    }
+                } else if (midiEvent.data1 == drive_marker) {
+                    for (int index : partTracks) {
+                        m_tracks[index].set_event(EventType::drive, midiEvent.time, on);
+                    }
+                } else {
+                    const NoteRoute &route = routes[midiEvent.data1 & 0x7f];
+                    if (route.track != -1) {
+                        m_tracks[route.track].add_note(route.note, midiEvent.time, on);
+                    }
                 }
-                m_length = midiTrack->endTime;
-                break;
+            });
+
+            for (int index : partTracks) {
+                m_tracks[index].build_chords(m_tempoTrack);
             }
+            return midiTrack.endTime;
         }
-        m_tracks.push_back(track);
+        return 0.0;
     }
 
     // Load all tracks
     void Song::load_tracks()
     {
+        // The tracks were already restored by load.
+        if (m_cacheLoaded)
+        {
+            compile();
+            return;
+        }
+        if (m_compiled)
+        {
+            throw std::runtime_error(_("Song tracks were already loaded."));
+        }
+
+        std::vector<TrackType> parts;
+
+        m_tracks.reserve(m_tracksInfo.size());
         for (auto &trackInfo : m_tracksInfo)
         {
-            load_track(trackInfo);
+            m_tracks.emplace_back(trackInfo);
+            if (std::find(parts.begin(), parts.end(), trackInfo.type) == parts.end())
+            {
+                parts.push_back(trackInfo.type);
+            }
+        }
+
+        // Each part only writes to its own tracks and the reader can be visited
+        // from several threads, so the parts are loaded concurrently.
+        std::vector<double> partLengths(parts.size(), 0.0);
+        std::atomic<size_t> partsDone {0};
+        std::thread::id loadingThread = std::this_thread::get_id();
+
+        report_progress(SongLoadStage::Tracks, 0.0f);
+        ORCore::parallel_for(parts.size(), [&](size_t i)
+        {
+            partLengths[i] = load_part(parts[i]);
+
+            // The workers only publish their progress, the callback is left to the
+            // loading thread which also works through parts. The last part is
+            // reported once all of them are done, after the loop.
+            size_t done = ++partsDone;
+            if (done == parts.size())
+            {
+                return;
+            }
+
+            float progress = static_cast<float>(done) / parts.size();
+            if (std::this_thread::get_id() == loadingThread)
+            {
+                report_progress(SongLoadStage::Tracks, progress);
+            } else {
+                publish_progress(SongLoadStage::Tracks, progress);
+            }
+        });
+        report_progress(SongLoadStage::Tracks, 1.0f);
+
+        for (double partLength : partLengths)
+        {
+            m_length = std::max(m_length, partLength);
         }
         logger->debug(_("{} Tracks processed"), m_tracks.size());
+
+        report_progress(SongLoadStage::Cache, 0.0f);
+        save_cache();
+        compile();
+    }
+
+    void Song::compile()
+    {
+        if (m_midi)
+        {
+            logger->debug(_("Releasing midi, {} bytes retained before compiling"), retained_bytes());
+            m_midi.reset();
+        }
+
+        m_tempoTrack.compact();
+        for (auto &track : m_tracks)
+        {
+            track.compact();
+        }
+        m_tracks.shrink_to_fit();
+        m_tracksInfo.shrink_to_fit();
+        m_compiled = true;
+        logger->debug(_("Song compiled, {} bytes retained"), retained_bytes());
+    }
+
+    bool Song::is_compiled()
+    {
+        return m_compiled;
+    }
+
+    size_t Song::retained_bytes()
+    {
+        size_t bytes = sizeof(Song) + m_tempoTrack.retained_bytes();
+        bytes += vector_bytes(m_tracks) + vector_bytes(m_tracksInfo);
+        for (auto &track : m_tracks)
+        {
+            bytes += track.retained_bytes();
+        }
+        if (m_midi)
+        {
+            bytes += sizeof(ORCore::SmfReader) + m_midi->retained_bytes();
+        }
+        return bytes;
+    }
+
+    bool Song::load_cache()
+    {
+        CachedSong cached;
+        try {
+            if (!read_song_cache(m_cachePath, m_midiPath, cached))
+            {
+                return false;
+            }
+        } catch (std::runtime_error &err) {
+            return false;
+        }
+
+        *m_tempoTrack.get_tempo_data() = std::move(cached.tempo);
+        m_tempoTrack.mark_bars();
+
+        for (auto &cachedTrack : cached.tracks)
+        {
+            Track track(cachedTrack.info);
+            track.set_note_data(cachedTrack.notes, cached.file);
+            *track.get_events() = std::move(cachedTrack.events);
+            track.build_chords(m_tempoTrack);
+
+            m_tracksInfo.push_back(cachedTrack.info);
+            m_tracks.push_back(std::move(track));
+        }
+        m_length = cached.length;
+        m_cacheLoaded = true;
+        return true;
+    }
+
+    void Song::save_cache()
+    {
+        try {
+            write_song_cache(m_cachePath, get_song_cache_key(m_midiPath), *this);
+        } catch (std::runtime_error &err) {
+            logger->warn(_("Failed to save song cache: {}"), err.what());
+        }
+    }
+
+    SongLoad Song::load_async(std::string midiPath, SongLoadCallback callback)
+    {
+        // A second loader would work on the same tracks and midi as the first.
+        if (m_loadState && m_loadState->future.valid() &&
+            m_loadState->future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            throw std::runtime_error(_("Song is already loading."));
+        }
+
+        m_midiPath = midiPath;
+        m_cachePath = midiPath + ".cache";
+
+        m_loadState = std::make_shared<SongLoadState>();
+        m_loadState->callback = callback;
+
+        m_loadState->future = std::async(std::launch::async, [this]()
+        {
+            load();
+            load_tracks();
+            report_progress(SongLoadStage::Done, 1.0f);
+        }).share();
+
+        return SongLoad(m_loadState);
+    }
+
+    static bool progress_before(const SongLoadProgress &a, const SongLoadProgress &b)
+    {
+        return a.stage < b.stage || (a.stage == b.stage && a.progress < b.progress);
+    }
+
+    void Song::publish_progress(SongLoadStage stage, float progress)
+    {
+        if (!m_loadState)
+        {
+            return;
+        }
+
+        // Parts can finish in any order, so only ever move the progress forward.
+        SongLoadProgress next {stage, progress};
+        SongLoadProgress current = m_loadState->progress.load();
+        while (progress_before(current, next) && !m_loadState->progress.compare_exchange_weak(current, next))
+        {
+        }
+    }
+
+    void Song::report_progress(SongLoadStage stage, float progress)
+    {
+        if (!m_loadState)
+        {
+            return;
+        }
+
+        publish_progress(stage, progress);
+        if (m_loadState->callback)
+        {
+            m_loadState->callback(stage, progress);
+        }
     }
 
     std::vector<Track> *Song::get_tracks()
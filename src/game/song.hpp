@@ -1,7 +1,12 @@
 #pragma once
+#include <array>
+#include <atomic>
+#include <functional>
+#include <future>
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
 #include <spdlog/spdlog.h>
 
 #include "smf.hpp"
@@ -39,6 +44,8 @@ namespace ORGame
         Orange,
     };
 
+    const size_t noteLaneCount = static_cast<size_t>(NoteType::Orange) + 1;
+
     enum class TempoEventType
     {
         Note,
@@ -57,14 +64,57 @@ namespace ORGame
         int power;
     };
 
-    struct TrackNote
+    // Bit used for a lane in a lane mask, lanes are ordered Green to Orange.
+    uint8_t lane_bit(NoteType type);
+    NoteType lane_note_type(uint8_t laneBit);
+
+    // A track's notes as parallel arrays in time order, index i of each array
+    // is the i-th note. Only what judging and rendering need lives here,
+    // times are in seconds and lanes are single lane bits. The arrays are
+    // owned by the track, or by the song cache the track was loaded from.
+    struct TrackNotes
     {
-        NoteType type;
-        double time;
-        double length;
-        int objNoteID;
-        int objTailID;
-        bool played;
+        const float *time;
+        const float *length;
+        const uint8_t *lane;
+        size_t count;
+
+        size_t size() const;
+    };
+
+    enum ChordFlag : uint8_t
+    {
+        ChordHopo = 1 << 0,    // Can be played as a hammer-on or pull-off without strumming.
+        ChordSustain = 1 << 1, // Long enough to be held until sustainEnd.
+    };
+
+    // The notes of a track that start at the same time, built once the track is
+    // loaded so gameplay doesn't have to group notes each frame. The chord's
+    // notes are notes firstNote to firstNote + noteCount of the track.
+    struct TrackChord
+    {
+        float time;
+        float sustainEnd; // Same as time when the chord isn't sustained.
+        uint32_t firstNote;
+        uint32_t noteCount;
+        uint8_t lanes;
+        uint8_t flags;
+    };
+
+    // Render objects of a note, set when the note is added to the renderer.
+    struct NoteObjects
+    {
+        int note;
+        int tail;
+    };
+
+    // An index range of a track's notes.
+    struct TrackRange
+    {
+        size_t start;
+        size_t end;
+
+        size_t size() const;
     };
 
     struct TempoEvent
@@ -97,6 +147,8 @@ namespace ORGame
         freestyle,
     };
 
+    const size_t eventLaneCount = static_cast<size_t>(EventType::freestyle) + 1;
+
     // Events are for things that have a position/length with no special data accociated with them
     // So drive/solo/freestyle are some examples.
     struct Event
@@ -107,28 +159,82 @@ namespace ORGame
     };
 
 
+    // A stretch of constant tempo and time signature. Bar lines are generated
+    // from these on demand rather than stored for the whole song.
+    struct BarSegment
+    {
+        double time;
+        double beatLength;
+        double beatOffset; // Beats since the last time signature change, may be fractional.
+        int numerator;
+    };
+
     struct TrackInfo
     {
         TrackType type;
         Difficulty difficulty;
     };
 
+    // A range of one of the song's time sorted arrays. It points into that
+    // array, so it is only valid until the array is modified.
+    template<typename T>
+    struct TrackView
+    {
+        T *items;
+        size_t start;
+        size_t end;
+
+        size_t size() const;
+        T &operator[](size_t index) const;
+    };
+
+    template<typename T>
+    inline size_t TrackView<T>::size() const
+    {
+        return end - start;
+    }
+
+    template<typename T>
+    inline T &TrackView<T>::operator[](size_t index) const
+    {
+        return items[start + index];
+    }
+
+    // Where the last window into an array started and ended, so the next
+    // lookup only has to step over what the window moved past.
+    struct TrackCursor
+    {
+        size_t start = 0;
+        size_t end = 0;
+    };
+
     class TempoTrack
     {
     public:
         void add_tempo_event(int ppqn, double time);
         void add_time_sig_event(int numerator, int denominator, int compoundFactor, double time);
 
-        std::vector<TempoEvent*> get_events(double start, double end);
-        std::vector<TempoEvent*> get_events();
+        TrackView<TempoEvent> get_events(double start, double end);
+        TrackView<TempoEvent> get_events();
 
+        // Builds the segments bar lines are generated from, call after the tempo events are added.
         void mark_bars();
-        std::vector<BarEvent*> get_bars(double start, double end);
-        std::vector<BarEvent*> get_bars();
+
+        // Fills bars with the measure and beat lines with start <= time <= end.
+        // The vector is cleared first so it can be reused each frame without allocating.
+        void get_bars(double start, double end, std::vector<BarEvent> &bars);
+
+        // Direct access to the underlying storage, used by the song cache.
+        std::vector<TempoEvent> *get_tempo_data();
+
+        // Drops spare capacity left over from loading.
+        void compact();
+        size_t retained_bytes();
 
     private:
     	std::vector<TempoEvent> m_tempo;
-        std::vector<BarEvent> m_bars;
+        std::vector<BarSegment> m_barSegments;
+        TrackCursor m_tempoCursor;
     };
 
 
@@ -141,26 +247,121 @@ namespace ORGame
         TrackInfo info();
 
         void add_note(NoteType type, double time, bool on);
-        std::vector<TrackNote*> get_notes_in_frame(double start, double end);
-        std::vector<TrackNote*> get_notes();
+        TrackRange get_notes();
 
         void set_event(EventType type, double time, bool on);
         std::vector<Event> *get_events();
+        TrackNotes *get_note_data();
+
+        // Uses notes stored elsewhere instead of adding them, source is kept
+        // alive for as long as the track points into it.
+        void set_note_data(TrackNotes notes, std::shared_ptr<ORCore::FileBuffer> source);
+
+        // Groups the notes into chords, the tempo is used for the HOPO threshold.
+        // Call once all notes are added.
+        void build_chords(TempoTrack &tempoTrack);
+        std::vector<TrackChord> *get_chords();
+
+        // Render and play state are kept apart from the note data so scans over
+        // the notes don't pull them in. Both are sized to the notes on first use.
+        std::vector<NoteObjects> *get_note_objects();
+        std::vector<uint8_t> *get_played();
+
+        // Drops spare capacity left over from loading.
+        void compact();
+        size_t retained_bytes();
 
     private:
         TrackInfo m_info;
-        std::vector<TrackNote> m_notes;
+        TrackNotes m_notes;
+
+        // Notes added while loading from the midi, m_notes points into these
+        // unless the notes came from the song cache.
+        std::vector<float> m_noteTime;
+        std::vector<float> m_noteLength;
+        std::vector<uint8_t> m_noteLane;
+        std::shared_ptr<ORCore::FileBuffer> m_noteSource;
+        std::vector<TrackChord> m_chords;
+        std::vector<NoteObjects> m_noteObjects;
+        std::vector<uint8_t> m_played;
         std::vector<Event> m_events;
+
+        // Index of the note or event that is still open in each lane, -1 if there is none.
+        std::array<int, noteLaneCount> m_openNotes;
+        std::array<int, eventLaneCount> m_openEvents;
+    };
+
+    // The stages a song load reports. Loading only covers the midi and its
+    // tracks, the song's audio isn't prefetched, so Done means the tracks are
+    // ready rather than that playback can start without waiting on audio.
+    enum class SongLoadStage
+    {
+        Midi,
+        Tracks,
+        Cache,
+        Done,
+    };
+
+    // Called from the loading thread whenever loading moves along, progress
+    // goes from 0 to 1 within each stage.
+    using SongLoadCallback = std::function<void(SongLoadStage stage, float progress)>;
+
+    // Stage and progress are published together so a reader never sees the
+    // progress of one stage paired with another stage.
+    struct SongLoadProgress
+    {
+        SongLoadStage stage;
+        float progress;
+    };
+
+    struct SongLoadState
+    {
+        // Only ever moves forward.
+        std::atomic<SongLoadProgress> progress {SongLoadProgress{SongLoadStage::Midi, 0.0f}};
+        SongLoadCallback callback;
+        std::shared_future<void> future;
+    };
+
+    // Handle to a song being loaded on a background thread. Copies share the
+    // same load, and the song mustn't be used until the load is ready.
+    class SongLoad
+    {
+    public:
+        SongLoad();
+        SongLoad(std::shared_ptr<SongLoadState> state);
+
+        bool valid();
+        bool is_ready();
+        SongLoadProgress get_progress();
+
+        // Blocks until loading is done, rethrowing any error it ran into.
+        void get();
+        std::shared_future<void> get_future();
+
+    private:
+        std::shared_ptr<SongLoadState> m_state;
     };
 
     class Song
     {
     public:
         Song(std::string songpath);
+        ~Song();
         void add(TrackType type, Difficulty difficulty);
         bool load();
-        void load_track(TrackInfo& trackInfo);
         void load_tracks();
+
+        // Frees the midi and everything else only needed while loading, leaving
+        // just the compiled tracks. load_tracks does this once it is done.
+        void compile();
+        bool is_compiled();
+
+        // Memory held by the song, the midi reader included until the song is compiled.
+        size_t retained_bytes();
+
+        // Runs load and load_tracks for the midi at midiPath on a background thread.
+        // Throws if the song is still loading from an earlier call.
+        SongLoad load_async(std::string midiPath, SongLoadCallback callback = nullptr);
         std::vector<Track> *get_tracks();
         std::vector<TrackInfo> *get_track_info();
         TempoTrack *get_tempo_track();
@@ -168,13 +369,29 @@ namespace ORGame
         double length();
 
     private:
-        ORCore::SmfReader m_midi;
+        double load_part(TrackType type);
+        // Publishes how far loading is, safe to call from any thread.
+        void publish_progress(SongLoadStage stage, float progress);
+        // Publishes and calls the load callback, only called from the loading thread.
+        void report_progress(SongLoadStage stage, float progress);
+        bool load_cache();
+        void save_cache();
+
+        // Only created when the song isn't in the cache.
+        std::unique_ptr<ORCore::SmfReader> m_midi;
         std::vector<TrackInfo> m_tracksInfo;
         std::vector<Track> m_tracks;
         TempoTrack m_tempoTrack;
         std::string m_path;
+        std::string m_midiPath;
+        std::string m_cachePath;
+        bool m_cacheLoaded;
+        bool m_compiled;
         double m_length;
 
+        // Only set while loading asynchronously.
+        std::shared_ptr<SongLoadState> m_loadState;
+
     };
 
     // Functions are mainly used within the Song class
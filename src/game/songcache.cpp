@@ -0,0 +1,298 @@
+#include "config.hpp"
+#include "songcache.hpp"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <sys/stat.h>
+
+#include "parseutils.hpp"
+
+namespace ORGame
+{
+    static const char songCacheMagic[4] = {'O', 'R', 'S', 'C'};
+
+    // The cache is a header followed by the tempo array, then for each track a
+    // track header followed by its note time, length and lane arrays and its
+    // event array. Everything is stored in native layout, so the note arrays
+    // are used straight from the mapped file and the rest is a copy of each
+    // array. The struct sizes are recorded so a cache from a different build
+    // is rejected.
+    struct SongCacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t noteSize;
+        uint32_t eventSize;
+        uint32_t tempoSize;
+        SongCacheKey key;
+        double length;
+        uint32_t tempoCount;
+        uint32_t trackCount;
+    };
+
+    struct SongCacheTrackHeader
+    {
+        TrackInfo info;
+        uint32_t noteCount;
+        uint32_t eventCount;
+    };
+
+    // Every block is padded to this, so each array starts suitably aligned
+    // for use in place.
+    const uint32_t songCacheAlignment = 8;
+
+    static uint32_t cache_padding(size_t length)
+    {
+        return static_cast<uint32_t>((songCacheAlignment - length % songCacheAlignment) % songCacheAlignment);
+    }
+
+    // FNV-1a over 8 byte words, the midi only needs to be told apart from other versions of itself.
+    static uint64_t hash_bytes(const char *data, uint32_t size)
+    {
+        const uint64_t prime = 0x100000001b3;
+        uint64_t hash = 0xcbf29ce484222325;
+
+        uint32_t i = 0;
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+        {
+            uint64_t word;
+            std::memcpy(&word, data + i, sizeof(word));
+            hash = (hash ^ word) * prime;
+        }
+        for (; i < size; i++)
+        {
+            hash = (hash ^ static_cast<uint8_t>(data[i])) * prime;
+        }
+        return hash;
+    }
+
+    static SongCacheHeader make_header(const SongCacheKey &key)
+    {
+        SongCacheHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, songCacheMagic, sizeof(songCacheMagic));
+        header.version = songCacheVersion;
+        header.noteSize = sizeof(float) * 2 + sizeof(uint8_t);
+        header.eventSize = sizeof(Event);
+        header.tempoSize = sizeof(TempoEvent);
+        header.key = key;
+        return header;
+    }
+
+    // Returns the count items at the current position and moves past them and their padding.
+    template<typename T>
+    static const T *view_cache_data(ORCore::FileBuffer &file, size_t count)
+    {
+        uint64_t length = sizeof(T) * static_cast<uint64_t>(count);
+        uint64_t padded = length + cache_padding(length);
+        if (padded > file.get_size() - file.get_pos())
+        {
+            throw std::runtime_error(_("Song cache is truncated."));
+        }
+
+        const char *data = file.data + file.get_pos();
+        if (reinterpret_cast<uintptr_t>(data) % alignof(T) != 0)
+        {
+            throw std::runtime_error(_("Song cache is misaligned."));
+        }
+        file.set_pos_rel(static_cast<uint32_t>(padded));
+        return reinterpret_cast<const T*>(data);
+    }
+
+    template<typename T>
+    static void read_cache_data(ORCore::FileBuffer &file, T *out, size_t count)
+    {
+        const T *data = view_cache_data<T>(file, count);
+        std::memcpy(out, data, sizeof(T) * count);
+    }
+
+    template<typename T>
+    static void read_cache_array(ORCore::FileBuffer &file, std::vector<T> &out, uint32_t count)
+    {
+        const T *data = view_cache_data<T>(file, count);
+        out.assign(data, data + count);
+    }
+
+    template<typename T>
+    static void write_cache_data(std::ofstream &file, const T *data, size_t count)
+    {
+        static const char padding[songCacheAlignment] = {};
+        size_t length = sizeof(T) * count;
+        file.write(reinterpret_cast<const char*>(data), length);
+        file.write(padding, cache_padding(length));
+    }
+
+    // Fills in the midi's size and modification time, the hash is left alone.
+    static void stat_midi(std::string midiPath, SongCacheKey &key)
+    {
+#if defined(PLATFORM_WINDOWS)
+        struct _stat64 fileStat;
+        if (_stat64(midiPath.c_str(), &fileStat) != 0)
+#else
+        struct stat fileStat;
+        if (stat(midiPath.c_str(), &fileStat) != 0)
+#endif
+        {
+            throw std::runtime_error(_("Failed to load file."));
+        }
+
+        key.midiSize = static_cast<uint64_t>(fileStat.st_size);
+        key.midiMtime = static_cast<int64_t>(fileStat.st_mtime);
+    }
+
+    static uint64_t hash_midi(std::string midiPath)
+    {
+        ORCore::FileBuffer midiFile;
+        midiFile.map(midiPath);
+        return hash_bytes(midiFile.data, midiFile.get_size());
+    }
+
+    SongCacheKey get_song_cache_key(std::string midiPath)
+    {
+        SongCacheKey key {};
+        stat_midi(midiPath, key);
+        key.midiHash = hash_midi(midiPath);
+        return key;
+    }
+
+    // A midi that was only touched keeps its cache, one that changed size can't match.
+    // key is set to the midi's current size and modification time.
+    static bool is_cache_current(const SongCacheKey &cached, std::string midiPath, bool verifyHash, SongCacheKey &key)
+    {
+        stat_midi(midiPath, key);
+        key.midiHash = cached.midiHash;
+
+        if (key.midiSize != cached.midiSize)
+        {
+            return false;
+        }
+        if (key.midiMtime == cached.midiMtime && !verifyHash)
+        {
+            return true;
+        }
+        return hash_midi(midiPath) == cached.midiHash;
+    }
+
+    // Records the new modification time of a touched midi, so it isn't hashed again next time.
+    static void update_cache_key(std::string cachePath, const SongCacheKey &key)
+    {
+        std::fstream file(cachePath, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+        file.seekp(offsetof(SongCacheHeader, key));
+        file.write(reinterpret_cast<const char*>(&key), sizeof(key));
+    }
+
+    bool read_song_cache(std::string cachePath, std::string midiPath, CachedSong &song, bool verifyHash)
+    {
+        auto logger = spdlog::get("default");
+
+        // Shared with the tracks, which use the note arrays in place.
+        auto file = std::make_shared<ORCore::FileBuffer>();
+        try {
+            file->map(cachePath);
+        } catch (std::runtime_error &err) {
+            logger->debug(_("No song cache found at {}."), cachePath);
+            return false;
+        }
+
+        try {
+            SongCacheHeader expected = make_header(SongCacheKey {});
+            SongCacheHeader header;
+            read_cache_data(*file, &header, 1);
+
+            // Everything before the key must match exactly, the key is checked against the midi.
+            SongCacheKey key;
+            if (std::memcmp(&header, &expected, offsetof(SongCacheHeader, key)) != 0 ||
+                !is_cache_current(header.key, midiPath, verifyHash, key))
+            {
+                logger->info(_("Song cache is out of date, rebuilding."));
+                return false;
+            }
+
+            CachedSong cached;
+            cached.file = file;
+            cached.length = header.length;
+            read_cache_array(*file, cached.tempo, header.tempoCount);
+
+            cached.tracks.resize(header.trackCount);
+            for (auto &track : cached.tracks)
+            {
+                SongCacheTrackHeader trackHeader;
+                read_cache_data(*file, &trackHeader, 1);
+
+                track.info = trackHeader.info;
+                track.notes.count = trackHeader.noteCount;
+                track.notes.time = view_cache_data<float>(*file, trackHeader.noteCount);
+                track.notes.length = view_cache_data<float>(*file, trackHeader.noteCount);
+                track.notes.lane = view_cache_data<uint8_t>(*file, trackHeader.noteCount);
+                read_cache_array(*file, track.events, trackHeader.eventCount);
+            }
+
+            song = std::move(cached);
+
+            if (key.midiMtime != header.key.midiMtime)
+            {
+                update_cache_key(cachePath, key);
+            }
+        } catch (std::runtime_error &err) {
+            logger->warn(_("Song cache is corrupt, rebuilding: {}"), err.what());
+            return false;
+        }
+        return true;
+    }
+
+    void write_song_cache(std::string cachePath, const SongCacheKey &key, Song &song)
+    {
+        std::vector<TempoEvent> &tempo = *song.get_tempo_track()->get_tempo_data();
+        std::vector<Track> &tracks = *song.get_tracks();
+
+        SongCacheHeader header = make_header(key);
+        header.length = song.length();
+        header.tempoCount = static_cast<uint32_t>(tempo.size());
+        header.trackCount = static_cast<uint32_t>(tracks.size());
+
+        // Write to a temporary file first so a partly written cache is never picked up.
+        std::string tempPath = cachePath + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios_base::binary | std::ios_base::trunc);
+            if (!file)
+            {
+                throw std::runtime_error(_("Failed to write song cache."));
+            }
+
+            write_cache_data(file, &header, 1);
+            write_cache_data(file, tempo.data(), tempo.size());
+
+            for (auto &track : tracks)
+            {
+                TrackNotes &notes = *track.get_note_data();
+                std::vector<Event> &events = *track.get_events();
+
+                SongCacheTrackHeader trackHeader {};
+                trackHeader.info = track.info();
+                trackHeader.noteCount = static_cast<uint32_t>(notes.size());
+                trackHeader.eventCount = static_cast<uint32_t>(events.size());
+
+                write_cache_data(file, &trackHeader, 1);
+                write_cache_data(file, notes.time, notes.size());
+                write_cache_data(file, notes.length, notes.size());
+                write_cache_data(file, notes.lane, notes.size());
+                write_cache_data(file, events.data(), events.size());
+            }
+
+            if (!file)
+            {
+                throw std::runtime_error(_("Failed to write song cache."));
+            }
+        }
+
+        std::remove(cachePath.c_str());
+        if (std::rename(tempPath.c_str(), cachePath.c_str()) != 0)
+        {
+            std::remove(tempPath.c_str());
+            throw std::runtime_error(_("Failed to write song cache."));
+        }
+    }
+} // namespace ORGame
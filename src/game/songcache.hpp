@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "song.hpp"
+
+namespace ORGame
+{
+    // Bump whenever the layout of the cache or of the structs stored in it changes.
+    const uint32_t songCacheVersion = 4;
+
+    // Identifies the midi a cache was compiled from.
+    struct SongCacheKey
+    {
+        uint64_t midiSize;
+        int64_t midiMtime;
+        uint64_t midiHash;
+    };
+
+    struct CachedTrack
+    {
+        TrackInfo info;
+        TrackNotes notes; // Points into the mapped cache file.
+        std::vector<Event> events;
+    };
+
+    // The flattened result of loading a song, this is everything Song builds from the midi.
+    struct CachedSong
+    {
+        std::shared_ptr<ORCore::FileBuffer> file;
+        double length;
+        std::vector<TempoEvent> tempo;
+        std::vector<CachedTrack> tracks;
+    };
+
+    SongCacheKey get_song_cache_key(std::string midiPath);
+
+    // Returns false if there is no usable cache for the midi, the song is left untouched in that case.
+    // A cache whose midi size and modification time still match is used without reading the midi,
+    // the midi is only hashed when its modification time changed or verifyHash is set.
+    bool read_song_cache(std::string cachePath, std::string midiPath, CachedSong &song, bool verifyHash = false);
+    void write_song_cache(std::string cachePath, const SongCacheKey &key, Song &song);
+} // namespace ORGame
@@ -21,28 +21,27 @@ namespace MidiPlayer
     Track::Track()
     {
         logger = spdlog::get("default");
+        m_openNotes.fill(-1);
     }
 
+    // A midi note value only holds one note at a time, so a note on for a
+    // value that is still open ends the open note.
     void Track::add_note(int noteValue, double time, bool on)
     {
-        static std::vector<std::pair<int, int>> activeNotes;
+        if (noteValue < 0 || noteValue >= static_cast<int>(m_openNotes.size())) {
+            return;
+        }
+
+        int &open = m_openNotes[noteValue];
 
+        if (open != -1) {
+            auto &note = m_notes[open];
+            note.length = time - note.time;
+            open = -1;
+        }
         if (on) {
-            int index = m_notes.size();
-            activeNotes.emplace_back(noteValue, index);
+            open = static_cast<int>(m_notes.size());
             m_notes.push_back({time, 0.0, noteValue});
-        } else {
-            auto findFunc = [&](const auto& element)
-            {
-                return element.first == noteValue;
-            };
-            auto item = std::find_if( activeNotes.begin(), activeNotes.end(), findFunc);
-            if (item != activeNotes.end())
-            {
-                auto &note = m_notes[item->second];
-                note.length = time - note.time;
-                activeNotes.erase(item);
-            }
         }
     }
 
@@ -143,23 +142,23 @@ namespace MidiPlayer
     {
 
 
-        std::vector<ORCore::SmfTrack*> midiTracks = m_midi.get_tracks();
-        logger->info("tracks: {}", midiTracks.size());
+        size_t trackCount = m_midi.get_track_names().size();
+        logger->info("tracks: {}", trackCount);
         
-        for (auto midiTrack : midiTracks) {
+        for (size_t i = 0; i < trackCount; i++) {
             Track track;
-            for (auto &midiEvent : midiTrack->midiEvents) {
-                try {
-                    if (midiEvent.message == ORCore::NoteOn) {
-                        track.add_note(midiEvent.data1, m_midi.pulsetime_to_abstime(midiEvent.info.pulseTime), true);
-                    } else if (midiEvent.message == ORCore::NoteOff) {
-                        track.add_note(midiEvent.data1, m_midi.pulsetime_to_abstime(midiEvent.info.pulseTime), false);
-                    }
-                } catch (std::out_of_range &err) {
-                    continue;
+            ORCore::SmfTrack midiTrack = m_midi.visit_track(i, [&](const ORCore::SmfVisitEvent &midiEvent)
+            {
+                auto message = midiEvent.message();
+                if (message != ORCore::NoteOn && message != ORCore::NoteOff) {
+                    return;
                 }
-            }
-            m_length = midiTrack->endTime;
+
+                // A NoteOn with a velocity of 0 is treated the same as a NoteOff.
+                bool on = message == ORCore::NoteOn && midiEvent.data2 != 0;
+                track.add_note(midiEvent.data1, midiEvent.time, on);
+            });
+            m_length = midiTrack.endTime;
             m_tracks.push_back(track);
         }
 
@@ -1,4 +1,5 @@
 #pragma once
+#include <array>
 #include <string>
 #include <vector>
 #include <map>
@@ -34,6 +35,9 @@ namespace MidiPlayer
     private:
         std::vector<TrackNote> m_notes;
 
+        // Index of the note still open for each midi note value, -1 if there is none.
+        std::array<int, 128> m_openNotes;
+
         std::vector<int> m_noteValues;
         std::vector<double> m_time;
         std::vector<double> m_length;
@@ -5,7 +5,9 @@
 #include <thread>
 #include "core/audio/codecs/vorbis.hpp"
 #include "core/audio/streams/resample.hpp"
+#include "core/audio/streams/voices.hpp"
 #include "core/audio/output/soundio.hpp"
+#include "core/audio/samplebank.hpp"
 
 #include <spdlog/spdlog.h>
 
@@ -77,6 +79,8 @@ int main(int argc, char *argv[]) {
 
         logger->info(_("SongSampleRate: {}"), songSampleRate);
 
+        resamplerstream->setGain(volume_track.getValue() / 100.0f);
+
         logger->debug(_("addstream resamplerstream"));
         soundOutput->add_stream(resamplerstream);
     } catch (const std::runtime_error& err) {
@@ -100,6 +104,8 @@ int main(int argc, char *argv[]) {
         anotherResamplerstream->setInputSampleRate(anotherOggSampleRate);
         anotherResamplerstream->setOutputSampleRate(outputSampleRate);
 
+        anotherResamplerstream->setGain(volume_background.getValue() / 100.0f);
+
         soundOutput->add_stream(anotherResamplerstream);
     } catch (const std::runtime_error& err) {
         std::cout << _("opening ogg vorbis file failed: ") << err.what() << std::endl;
@@ -107,8 +113,35 @@ int main(int argc, char *argv[]) {
 
 
 
+    // Short sounds are decoded once into a bank and then played over the
+    // streams, here the second file is played at each sound effect volume.
+    ORCore::SampleBank sampleBank(outputSampleRate, soundOutput->get_channel_count());
+    ORCore::VoicePlayer *voicePlayer = nullptr;
+    int sampleId = -1;
+    try {
+        sampleId = sampleBank.load(OggAnotherFile);
+
+        voicePlayer = new ORCore::VoicePlayer(sampleBank);
+        soundOutput->add_stream(voicePlayer);
+    } catch (const std::runtime_error& err) {
+        std::cout << _("loading sample failed: ") << err.what() << std::endl;
+    }
+
+    const std::vector<std::pair<std::string, int>> effectVolumes {
+        {"effects",  volume_effects.getValue()},
+        {"miss",     volume_miss.getValue()},
+        {"screw-up", volume_screw_up.getValue()},
+        {"crowd",    volume_crowd.getValue()},
+    };
+
     // Wait a while then stop all that
-    std::this_thread::sleep_for(std::chrono::milliseconds(5000));
+    for (auto &effect : effectVolumes) {
+        if (voicePlayer) {
+            logger->debug(_("play sample at {} volume"), effect.first);
+            voicePlayer->play(sampleId, effect.second / 100.0f);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1250));
+    }
     soundOutput->destroy();
     soundOutput->disconnect_device();
 
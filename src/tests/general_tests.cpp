@@ -1,18 +1,154 @@
 #include "config.hpp"
 
 #include <iostream>
+#include <vector>
 #include <yaml-cpp/yaml.h>
+#include <spdlog/spdlog.h>
 
 #include "configuration/parameter.hpp"
 #include "configuration.hpp"
+#include "judge.hpp"
+#include "smf.hpp"
 
+using namespace ORGame;
+
+// Strums are song times taken from millisecond event timestamps, one landing on
+// a note has to be judged with no delta at all.
+bool check_judge_on_time() {
+    const unsigned startTicks = 12345;
+    const unsigned noteTicks = 100;
+    const double noteTime = noteTicks / 1000.0;
+
+    Track track({TrackType::Guitar, Difficulty::Expert});
+    track.add_note(NoteType::Green, noteTime, true);
+    track.add_note(NoteType::Green, noteTime + 0.05, false);
+
+    TempoTrack tempoTrack;
+    track.build_chords(tempoTrack);
+
+    Judge judge(track, 0.07);
+    double songStart = startTicks / 1000.0;
+    double eventTime = (startTicks + noteTicks) / 1000.0;
+    JudgeEvent judged = judge.strum(eventTime - songStart, lane_bit(NoteType::Green));
+
+    if (judged.result != JudgeResult::Hit || judged.delta != 0.0) {
+        std::cout << "Judge: strum on a note judged " << static_cast<int>(judged.result)
+                  << " with a delta of " << judged.delta << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Two single notes 120 ticks apart at 480 ppqn, either side of a change from
+// 120 to 240 bpm at tick 1200. The gap is under the 170 tick HOPO threshold.
+bool check_hopo_across_tempo() {
+    TempoTrack tempoTrack;
+    tempoTrack.add_tempo_event(500'000, 0.0);
+    tempoTrack.add_tempo_event(250'000, 1.25);
+
+    Track track({TrackType::Guitar, Difficulty::Expert});
+    track.add_note(NoteType::Green, 1.1875, true);
+    track.add_note(NoteType::Green, 1.2, false);
+    track.add_note(NoteType::Red, 1.28125, true);
+    track.add_note(NoteType::Red, 1.29, false);
+    track.build_chords(tempoTrack);
+
+    std::vector<TrackChord> &chords = *track.get_chords();
+    if (chords.size() != 2 || (chords[1].flags & ChordHopo) == 0) {
+        std::cout << "Song: note 120 ticks after a tempo change wasn't marked as a HOPO" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// A guitar part with notes from every difficulty mixed with other channel
+// events, and a tempo change part way through.
+std::vector<uint8_t> build_scan_midi() {
+    ORCore::SmfWriter writer(ORCore::smfType1, 480);
+    size_t tempoTrack = writer.add_track("");
+    writer.add_tempo(tempoTrack, 0, 500'000);
+    writer.add_tempo(tempoTrack, 1200, 250'000);
+
+    size_t guitar = writer.add_track("PART GUITAR");
+    uint32_t seed = 1;
+    for (uint32_t i = 0; i < 500; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint8_t note = 0x3a + (seed >> 16) % 0x30;
+        writer.add_note(guitar, i * 60, 30, 0, note, 100);
+        if (i % 7 == 0) {
+            writer.add_midi_event(guitar, i * 60, ORCore::ControlChange, 0, note, 64);
+        }
+    }
+    return writer.get_data();
+}
+
+// The note scan has to find exactly the events a plain filter does.
+bool check_note_scan(ORCore::SmfReader &reader) {
+    ORCore::SmfEventArrays arrays;
+    reader.read_event_arrays("PART GUITAR", arrays);
+
+    const uint8_t low = 0x60;
+    const uint8_t high = 0x64;
+    std::vector<uint32_t> found;
+    ORCore::find_note_events(arrays, low, high, found);
+
+    std::vector<uint32_t> expected;
+    for (uint32_t i = 0; i < arrays.size(); i++) {
+        uint8_t message = arrays.status[i] & 0xF0;
+        if ((message == ORCore::NoteOn || message == ORCore::NoteOff) &&
+            arrays.data1[i] >= low && arrays.data1[i] <= high) {
+            expected.push_back(i);
+        }
+    }
+
+    if (expected.empty() || found != expected) {
+        std::cout << "Smf: note scan found " << found.size() << " events, expected "
+                  << expected.size() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Converting a track's times in one batch has to match converting them one at a time.
+bool check_convert_all(ORCore::SmfReader &reader) {
+    ORCore::SmfEventArrays arrays;
+    reader.read_event_arrays("PART GUITAR", arrays);
+
+    // Reversed as well, runs within a tempo segment mustn't rely on sorted input.
+    std::vector<uint32_t> pulses = arrays.pulseTime;
+    pulses.insert(pulses.end(), arrays.pulseTime.rbegin(), arrays.pulseTime.rend());
+
+    std::vector<double> times(pulses.size());
+    reader.convert_all(pulses.data(), times.data(), pulses.size());
+
+    for (size_t i = 0; i < pulses.size(); i++) {
+        if (times[i] != reader.pulsetime_to_abstime(pulses[i])) {
+            std::cout << "Smf: pulse " << pulses[i] << " converted to " << times[i] << ", expected "
+                      << reader.pulsetime_to_abstime(pulses[i]) << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
 
 int main(int argc, char *argv[]) {
     //std::cout << get_config_directory() << std::endl;
     readConfiguration(argc, argv);
     std::cout << path_library.getValue() << std::endl;;
 
+    if (!check_judge_on_time() || !check_hopo_across_tempo()) {
+        return 1;
+    }
+
+    auto logger = std::make_shared<spdlog::logger>("default", std::make_shared<spdlog::sinks::stdout_sink_mt>());
+    logger->set_level(spdlog::level::warn);
+    spdlog::register_logger(logger);
 
+    std::vector<uint8_t> scanMidi = build_scan_midi();
+    ORCore::SmfReader scanReader(reinterpret_cast<const char*>(scanMidi.data()), static_cast<uint32_t>(scanMidi.size()));
+    if (!check_note_scan(scanReader) || !check_convert_all(scanReader)) {
+        return 1;
+    }
 
 
     writeConfigurationFile();
@@ -0,0 +1,279 @@
+#include "config.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <tclap/CmdLine.h>
+
+#include "smf.hpp"
+
+// Generates synthetic charts for profiling SmfReader and Song loading.
+// The same arguments and seed always produce the same file.
+
+const std::vector<std::string> partNames {
+    "PART GUITAR",
+    "PART BASS",
+    "PART DRUMS",
+    "PART VOCALS",
+};
+
+const std::vector<std::string> fillerNames {
+    "VENUE",
+    "CAMERA",
+    "LIGHTING",
+    "CROWD",
+};
+
+// Lowest note of the five lanes for Expert, Hard, Medium and Easy.
+const std::vector<uint8_t> difficultyBaseNotes {0x60, 0x54, 0x48, 0x3c};
+const int laneCount = 5;
+
+struct GeneratorOptions
+{
+    int tracks;
+    int fillerTracks;
+    int notes;
+    double density;
+    int tempoInterval;
+    bool runningStatus;
+    int division;
+    unsigned int seed;
+};
+
+static std::string track_name(const std::vector<std::string> &names, int index)
+{
+    std::string name = names[index % names.size()];
+    if (index >= static_cast<int>(names.size()))
+    {
+        name += " " + std::to_string(index / names.size() + 1);
+    }
+    return name;
+}
+
+// With running status note offs are written as a note on with 0 velocity,
+// like most charting tools do, so consecutive notes share one status byte.
+static void add_note(ORCore::SmfWriter &writer, size_t track, const GeneratorOptions &options,
+                     uint32_t pulseTime, uint32_t length, uint8_t note)
+{
+    if (options.runningStatus)
+    {
+        writer.add_midi_event(track, pulseTime, ORCore::NoteOn, 0, note, 100);
+        writer.add_midi_event(track, pulseTime + length, ORCore::NoteOn, 0, note, 0);
+    } else {
+        writer.add_note(track, pulseTime, length, 0, note, 100);
+    }
+}
+
+// A part's note that isn't written yet, so it can still be cut short.
+struct HeldNote
+{
+    uint32_t pulseTime;
+    uint32_t length;
+    bool active;
+};
+
+using LaneNotes = std::array<HeldNote, laneCount>;
+
+// The first lane from preferred on, other than skip, that is free at pulseTime.
+// If every lane is still held preferred is returned and its note gets cut short.
+static int pick_lane(const LaneNotes &lanes, uint32_t pulseTime, int preferred, int skip)
+{
+    for (int i = 0; i < laneCount; i++)
+    {
+        int lane = (preferred + i) % laneCount;
+        const HeldNote &note = lanes[lane];
+        if (lane != skip && (!note.active || note.pulseTime + note.length <= pulseTime))
+        {
+            return lane;
+        }
+    }
+    return preferred;
+}
+
+// Writes the note held in a lane, ending it by endTime at the latest. Charts never
+// start a note on a pitch that is still sounding, the loader would truncate it.
+static void release_note(ORCore::SmfWriter &writer, size_t track, const GeneratorOptions &options,
+                         HeldNote &note, uint8_t pitch, uint32_t endTime)
+{
+    if (note.active)
+    {
+        add_note(writer, track, options, note.pulseTime, std::min(note.length, endTime - note.pulseTime), pitch);
+        note.active = false;
+    }
+}
+
+static void generate_part(ORCore::SmfWriter &writer, size_t track, const GeneratorOptions &options, std::mt19937 &rng)
+{
+    uint32_t step = std::max(1u, static_cast<uint32_t>(options.division / options.density));
+    std::uniform_int_distribution<int> lane(0, laneCount - 1);
+    std::uniform_int_distribution<int> percent(0, 99);
+
+    writer.reserve(track, options.notes * 2 + options.notes / 5);
+
+    // Notes are held back per difficulty and lane until the lane is used again.
+    std::vector<LaneNotes> heldNotes(difficultyBaseNotes.size(), LaneNotes{});
+
+    uint32_t pulseTime = 0;
+    for (int i = 0; i < options.notes; i++)
+    {
+        // Spread each position across the four difficulties like a real chart.
+        size_t difficulty = i % difficultyBaseNotes.size();
+        uint8_t baseNote = difficultyBaseNotes[difficulty];
+        LaneNotes &lanes = heldNotes[difficulty];
+        uint32_t length = std::max(1u, percent(rng) < 20 ? step * 4 : step / 2);
+
+        std::array<int, 2> chordLanes {{pick_lane(lanes, pulseTime, lane(rng), -1), -1}};
+
+        // Roughly one in ten notes is a chord.
+        if (percent(rng) < 10)
+        {
+            int secondLane = (chordLanes[0] + 1 + lane(rng) % 4) % laneCount;
+            chordLanes[1] = pick_lane(lanes, pulseTime, secondLane, chordLanes[0]);
+        }
+
+        for (int chordLane : chordLanes)
+        {
+            if (chordLane != -1)
+            {
+                release_note(writer, track, options, lanes[chordLane], baseNote + chordLane, pulseTime);
+                lanes[chordLane] = {pulseTime, length, true};
+            }
+        }
+
+        if (difficulty == difficultyBaseNotes.size() - 1)
+        {
+            pulseTime += step;
+        }
+    }
+
+    for (size_t difficulty = 0; difficulty < heldNotes.size(); difficulty++)
+    {
+        for (int noteLane = 0; noteLane < laneCount; noteLane++)
+        {
+            release_note(writer, track, options, heldNotes[difficulty][noteLane],
+                         difficultyBaseNotes[difficulty] + noteLane, UINT32_MAX);
+        }
+    }
+}
+
+static void generate_filler(ORCore::SmfWriter &writer, size_t track, const GeneratorOptions &options, std::mt19937 &rng)
+{
+    uint32_t step = std::max(1u, static_cast<uint32_t>(options.division / options.density));
+    std::uniform_int_distribution<int> note(0, 127);
+
+    writer.reserve(track, options.notes * 2);
+
+    for (int i = 0; i < options.notes; i++)
+    {
+        add_note(writer, track, options, i * step, step, note(rng));
+    }
+}
+
+static uint32_t generate_length(const GeneratorOptions &options)
+{
+    uint32_t step = std::max(1u, static_cast<uint32_t>(options.division / options.density));
+    return (options.notes / difficultyBaseNotes.size() + 1) * step;
+}
+
+static void generate_conductor(ORCore::SmfWriter &writer, size_t track, const GeneratorOptions &options, std::mt19937 &rng)
+{
+    std::uniform_int_distribution<int> bpm(80, 200);
+
+    writer.add_time_signature(track, 0, 4, 4);
+    writer.add_tempo(track, 0, 500'000);
+
+    if (options.tempoInterval > 0)
+    {
+        uint32_t interval = options.tempoInterval * options.division;
+        uint32_t length = generate_length(options);
+        for (uint32_t pulseTime = interval; pulseTime < length; pulseTime += interval)
+        {
+            writer.add_tempo(track, pulseTime, 60'000'000 / bpm(rng));
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    GeneratorOptions options;
+    std::string output;
+
+    try {
+        TCLAP::CmdLine cmd(
+            "Generates synthetic midi charts for load benchmarks.",
+            ' ',
+            QUOTE(VERSION_MAJOR) "." QUOTE(VERSION_MINOR),
+            true);
+
+        TCLAP::ValueArg<std::string> outputArg("o", "output", "Output file", false, "notes.mid", "path");
+        TCLAP::ValueArg<int> tracksArg("t", "tracks", "Number of playable part tracks", false, 1, "count");
+        TCLAP::ValueArg<int> fillerArg("f", "filler-tracks", "Number of non-playable tracks (venue, camera...)", false, 0, "count");
+        TCLAP::ValueArg<int> notesArg("n", "notes", "Notes per track", false, 1000, "count");
+        TCLAP::ValueArg<double> densityArg("d", "density", "Chart positions per beat", false, 4.0, "number");
+        TCLAP::ValueArg<int> tempoArg("c", "tempo-interval", "Beats between tempo changes, 0 for a constant tempo", false, 0, "beats");
+        TCLAP::SwitchArg runningArg("r", "running-status", "Use running status", false);
+        TCLAP::ValueArg<int> divisionArg("p", "division", "Pulses per quarter note", false, 480, "pulses");
+        TCLAP::ValueArg<unsigned int> seedArg("s", "seed", "Random seed", false, 0, "seed");
+
+        cmd.add(outputArg);
+        cmd.add(tracksArg);
+        cmd.add(fillerArg);
+        cmd.add(notesArg);
+        cmd.add(densityArg);
+        cmd.add(tempoArg);
+        cmd.add(runningArg);
+        cmd.add(divisionArg);
+        cmd.add(seedArg);
+        cmd.parse(argc, argv);
+
+        output = outputArg.getValue();
+        options.tracks = tracksArg.getValue();
+        options.fillerTracks = fillerArg.getValue();
+        options.notes = notesArg.getValue();
+        options.density = densityArg.getValue();
+        options.tempoInterval = tempoArg.getValue();
+        options.runningStatus = runningArg.getValue();
+        options.division = divisionArg.getValue();
+        options.seed = seedArg.getValue();
+    } catch (TCLAP::ArgException &e) {
+        std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+        return 1;
+    }
+
+    if (options.density <= 0.0 || options.notes < 0 || options.tracks < 0 || options.fillerTracks < 0)
+    {
+        std::cerr << "error: counts must be positive" << std::endl;
+        return 1;
+    }
+
+    try {
+        std::mt19937 rng(options.seed);
+
+        ORCore::SmfWriter writer(ORCore::smfType1, options.division);
+        writer.set_running_status(options.runningStatus);
+
+        generate_conductor(writer, writer.add_track(""), options, rng);
+
+        for (int i = 0; i < options.tracks; i++)
+        {
+            generate_part(writer, writer.add_track(track_name(partNames, i)), options, rng);
+        }
+        for (int i = 0; i < options.fillerTracks; i++)
+        {
+            generate_filler(writer, writer.add_track(track_name(fillerNames, i)), options, rng);
+        }
+
+        writer.write(output);
+    } catch (std::exception &err) {
+        std::cerr << "error: " << err.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "Wrote " << output << std::endl;
+    return 0;
+}